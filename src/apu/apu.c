@@ -28,6 +28,7 @@
 #include "../tools/deltacompress.h"
 #include "lfo/lfo.h"
 #include "io/2a03.h"
+#include "io/bus.h"
 
 
 /* The APU registers (discarding the 0x40 upper byte) */
@@ -173,7 +174,13 @@ inline void sq_setup(uint8_t n, struct square* sq)
 
 inline void sq_update(struct square* sq)
 {
-    sq->vol->duty = sq->duty;
+    int8_t duty = sq->duty + sq->duty_mod;
+    if (duty < 0)
+        duty = 0;
+    else if (duty > 3)
+        duty = 3;
+
+    sq->vol->duty = duty;
     sq->vol->volume_envelope = sq->volume;
     sq->lo->timer_low = sq->period & 0xFF;
     sq->hi->timer_high = (sq->period >> 8);
@@ -237,11 +244,19 @@ void dmc_setup(void)
     register_update(DMC_RAW, 0);
     register_update(DMC_START, 0);
     register_update(DMC_LEN, 0);
+
+    dmc.rate = DMC_RATE_NORMAL;
 }
 
 void dmc_update_sample_raw(void)
 {
+    // The byte is fetched on the next update if the bus is taken
+    uint8_t previous = bus_begin(BUS_DMC);
+    if (previous == BUS_REFUSED)
+        return;
+
     dmc.data = sample_read_byte(&dmc.sample);
+    bus_end(previous);
 
     io_register_write(DMC_RAW, dmc.data);
 
@@ -259,8 +274,18 @@ void dmc_update_sample(void)
     if (!dmc.sample_enabled)
         return;
 
-    if (dmc.sample.type == SAMPLE_TYPE_RAW)
+    if (dmc.sample.type != SAMPLE_TYPE_RAW)
+        return;
+
+    // Play back at a rate relative to the update rate by reading zero, one
+    // or more bytes per update
+    dmc.rate_phase += dmc.rate;
+    while (dmc.rate_phase >= DMC_RATE_NORMAL) {
+        dmc.rate_phase -= DMC_RATE_NORMAL;
         dmc_update_sample_raw();
+        if (!dmc.sample_enabled)
+            break;
+    }
 }
 
 void apu_refresh_channel(uint8_t ch_number)
@@ -36,8 +36,12 @@
 #define CHN_NOISE 3
 #define CHN_DMC 4
 
+/* DMC sample playback rate which gives one sample per update */
+#define DMC_RATE_NORMAL 64
+
 struct square {
     int8_t duty;             // 2-bit integer
+    int8_t duty_mod;         // Offset added to duty by modulation
     uint8_t volume;
     uint16_t period;
 
@@ -71,6 +75,8 @@ struct dmc {
     uint8_t sample_number;
     uint8_t sample_enabled : 1;
     uint8_t data : 7;
+    uint8_t rate;             // Playback rate, DMC_RATE_NORMAL is unaltered
+    uint8_t rate_phase;
 
     struct sample sample;
 };
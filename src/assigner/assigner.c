@@ -27,6 +27,9 @@
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include "modulation/modulation.h"
+#include "modulation/modmatrix.h"
+#include "macro/macro.h"
+#include "note_stack/note_stack.h"
 #include "portamento/portamento.h"
 #include "apu/apu.h"
 #include "envelope/envelope.h"
@@ -38,6 +41,7 @@
 
 enum assigner_mode assigner_lower_mode = MONO;
 enum assigner_mode assigner_upper_mode = MONO;
+enum assigner_policy assigner_policy = STEAL_OLDEST;
 bool assigner_split;
 int8_t assigner_split_point;
 int8_t assigner_upper_mask[5];
@@ -46,11 +50,28 @@ int8_t assigner_enabled[5];
 
 uint8_t assigned_notes[5];
 
+// MPE zone size, 0 when MPE is off
+uint8_t assigner_mpe_members;
+
+// MIDI channel of the note each channel plays, for MPE
+static uint8_t voice_channels[5];
+
+// Last pitch bend on each MPE member channel, applied when a note starts
+static uint16_t mpe_bends[15];
+
+// MIDI channel of the note currently being assigned
+static uint8_t note_midi_channel;
+
+// Note on count when each channel was last started, for finding the oldest
+static uint8_t note_stamps[5];
+static uint8_t note_count;
+
 struct group {
     uint8_t midi_channel;
     uint8_t last_assigned_lower;
     uint8_t last_assigned_upper;
     uint8_t members;
+    uint8_t velocity;        // Velocity of the last note on, after curve
 };
 
 static struct group groups[5];
@@ -64,6 +85,9 @@ static inline int8_t find_group(uint8_t midi_channel);
 static inline int8_t new_group(uint8_t midi_channel);
 static inline void group_notify_note_on(int8_t group, uint8_t note);
 static inline void group_notify_note_off(int8_t group, uint8_t note);
+static inline uint8_t allocate_channel(int8_t group, bool is_upper);
+static void start_note(uint8_t channel, uint8_t midi_note, bool legato, uint8_t velocity);
+static void join_group(uint8_t midi_channel, uint8_t chn);
 
 uint8_t midi_channels[5];
 
@@ -75,6 +99,12 @@ void assigner_setup(void)
     assigner_lower_mode = settings_read(ASSIGNER_LOWER_MODE);
     assigner_upper_mode = settings_read(ASSIGNER_UPPER_MODE);
     assigner_split = settings_read(ASSIGNER_SPLIT);
+    assigner_policy = settings_read(ASSIGNER_POLICY);
+
+    uint8_t members = settings_read(MPE_MEMBERS);
+    if (members)
+        assigner_mpe_configure(members);
+    portamento_legato = settings_read(GLIDE_LEGATO);
 }
 
 /* This is called by the SETTINGS UI when the user assigns
@@ -82,7 +112,11 @@ void assigner_setup(void)
 void assigner_midi_channel_change(uint8_t midi_channel, uint8_t chn)
 {
     settings_write(MIDI_CHN + chn, midi_channel);
+    join_group(midi_channel, chn);
+}
 
+static void join_group(uint8_t midi_channel, uint8_t chn)
+{
     // If new channel is different from old, remove chn as a member of its group
     if (midi_channels[chn] != midi_channel && midi_channels[chn] != 0) {
         // Avoid stuck notes
@@ -123,22 +157,118 @@ uint8_t assigner_channel_get(uint8_t midi_channel)
     return -1;
 }
 
+static inline int8_t find_note_group(uint8_t midi_channel)
+/* Notes on MPE member channels are played by the master channel's group */
+{
+    note_midi_channel = midi_channel;
+    if (assigner_mpe_member(midi_channel))
+        midi_channel = MPE_MASTER_CHANNEL;
+    return find_group(midi_channel);
+}
+
 void assigner_notify_note_on(uint8_t midi_channel, uint8_t note)
 {
     /* find the group listening on the channel */
     int8_t group;
-    if ((group = find_group(midi_channel)) != -1)
+    if ((group = find_note_group(midi_channel)) != -1)
         group_notify_note_on(group, note);
 }
 
 void assigner_notify_note_off(uint8_t midi_channel, uint8_t note)
 {
     /* find the group listening on the channel */
-    uint8_t group;
-    if ((group = find_group(midi_channel)) != -1)
+    int8_t group;
+    if ((group = find_note_group(midi_channel)) != -1)
         group_notify_note_off(group, note);
 }
 
+void assigner_mpe_configure(uint8_t members)
+/*
+  Sets up an MPE lower zone with the given number of member channels, or
+  turns MPE off for 0. In MPE mode, SQ1, SQ2, TRI and NOISE all listen to
+  the zone and are assigned polyphonically, each following the pitch
+  bend, pressure and timbre of the member channel of its note. The
+  channels' own MIDI channel settings are restored when MPE is turned
+  off.
+*/
+{
+    if (members > 15)
+        members = 15;
+
+    settings_write(MPE_MEMBERS, members);
+    assigner_mpe_members = members;
+
+    for (uint8_t i = 0; i < 15; i++)
+        mpe_bends[i] = 0x2000;
+
+    for (uint8_t chn = CHN_SQ1; chn <= CHN_NOISE; chn++)
+        join_group(members ? MPE_MASTER_CHANNEL : settings_read(MIDI_CHN + chn), chn);
+}
+
+bool assigner_mpe_member(uint8_t midi_channel)
+{
+    return assigner_mpe_members &&
+        midi_channel > MPE_MASTER_CHANNEL &&
+        midi_channel <= MPE_MASTER_CHANNEL + assigner_mpe_members;
+}
+
+uint8_t assigner_mpe_voices(uint8_t midi_channel)
+/* Returns a mask of the channels playing notes from an MPE member channel */
+{
+    uint8_t mask = 0;
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (assigned_notes[chn] && voice_channels[chn] == midi_channel)
+            mask |= 1 << chn;
+    }
+    return mask;
+}
+
+void assigner_mpe_bend(uint8_t midi_channel, uint16_t bend)
+{
+    mpe_bends[midi_channel - MPE_MASTER_CHANNEL - 1] = bend;
+
+    uint8_t voices = assigner_mpe_voices(midi_channel);
+    for (uint8_t chn = CHN_SQ1; chn <= CHN_TRI; chn++) {
+        if (voices & (1 << chn))
+            mod_pitchbend_input[chn] = bend;
+    }
+}
+
+void assigner_notify_velocity(uint8_t midi_channel, uint8_t velocity)
+/* Sets the velocity used by the following note on messages on the channel */
+{
+    int8_t group;
+    if ((group = find_note_group(midi_channel)) != -1)
+        groups[group].velocity = mod_curve_apply(mod_velocity_curve, velocity);
+}
+
+void assigner_notify_aftertouch(uint8_t midi_channel, uint8_t note, uint8_t pressure)
+/*
+  Applies aftertouch to the channels playing the given note, or to all
+  channels in the group for ASSIGNER_ALL_NOTES (channel pressure)
+*/
+{
+    uint8_t value = mod_curve_apply(mod_aftertouch_curve, pressure);
+
+    if (assigner_mpe_member(midi_channel)) {
+        uint8_t voices = assigner_mpe_voices(midi_channel);
+        for (uint8_t chn = 0; chn < 5; chn++) {
+            if (voices & (1 << chn))
+                mod_aftertouch[chn] = value;
+        }
+        return;
+    }
+
+    int8_t group;
+    if ((group = find_group(midi_channel)) == -1)
+        return;
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (has_member(group, chn) && (note == ASSIGNER_ALL_NOTES || assigned_notes[chn] == note))
+            mod_aftertouch[chn] = value;
+    }
+}
+
 
 static inline int8_t new_group(uint8_t midi_channel)
 {
@@ -148,6 +278,7 @@ static inline int8_t new_group(uint8_t midi_channel)
             groups[group].last_assigned_lower = 0;
             groups[group].last_assigned_upper = 0;
             groups[group].members = 0;
+            groups[group].velocity = 127;
             return group;
         }
     }
@@ -186,67 +317,252 @@ static inline int8_t find_group(uint8_t midi_channel)
     return -1;
 }
 
+static inline enum assigner_mode half_mode(bool is_upper)
+{
+    return (!assigner_split || is_upper) ? assigner_upper_mode : assigner_lower_mode;
+}
+
+static inline bool is_mono(bool is_upper)
+{
+    // Every MPE note has its own channel, so MPE notes are always polyphonic
+    if (assigner_mpe_members && (note_midi_channel == MPE_MASTER_CHANNEL || assigner_mpe_member(note_midi_channel)))
+        return false;
+
+    return half_mode(is_upper) != POLY;
+}
+
+static inline void unison_clear(uint8_t chn)
+{
+    if (chn <= CHN_TRI)
+        mod_unison_position[chn] = 0;
+    if (chn == CHN_SQ2)
+        mod_sq2_env = 1;
+}
+
+static inline bool in_half(uint8_t chn, bool is_upper)
+/* Whether a channel plays notes in the given half of the keyboard */
+{
+    return !assigner_split ||
+        (is_upper && (assigner_upper_mask[chn])) ||
+        (!is_upper && !(assigner_upper_mask[chn]));
+}
+
+static inline void unison_stack(int8_t group, bool is_upper)
+/*
+  Spreads the pitched channels playing in unison evenly across the
+  detune range. When both squares are stacked, SQ2 follows the SQ1
+  envelope instead of running its own.
+*/
+{
+    uint8_t stacked[3];
+    uint8_t n = 0;
+
+    for (uint8_t chn = CHN_SQ1; chn <= CHN_TRI; chn++) {
+        if (has_member(group, chn) && in_half(chn, is_upper) && assigner_enabled[chn])
+            stacked[n++] = chn;
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+        mod_unison_position[stacked[i]] = (n > 1) ? ((2 * i - (n - 1)) * 64) / (n - 1) : 0;
+
+    mod_sq2_env = (n >= 2 && stacked[0] == CHN_SQ1 && stacked[1] == CHN_SQ2) ? 0 : 1;
+    if (mod_sq2_env == 0) {
+        // ENV2 isn't updated while stacked, so it is left silent
+        env[1].gate = 0;
+        env[1].value = 0;
+    }
+}
+
 static inline void group_notify_note_on(int8_t group, uint8_t note)
 {
     bool is_upper = note >= assigner_split_point;
-    if ((!assigner_split && assigner_upper_mode == MONO) ||
-        (is_upper && assigner_upper_mode == MONO) ||
-        (!is_upper && assigner_lower_mode == MONO)) {
+    if (is_mono(is_upper)) {
+        if (half_mode(is_upper) == UNISON)
+            unison_stack(group, is_upper);
+        else {
+            for (uint8_t chn = 0; chn < 5; chn++) {
+                if (has_member(group, chn) && in_half(chn, is_upper))
+                    unison_clear(chn);
+            }
+        }
+
         for (uint8_t chn = 0; chn < 5; chn++) {
             if (!has_member(group, chn))
                 continue;
 
-            if (!assigner_split ||
-                (is_upper && (assigner_upper_mask[chn])) ||
-                (!is_upper && !(assigner_upper_mask[chn]))) {
+            if (in_half(chn, is_upper)) {
+                // A note arriving while the channel still holds one is
+                // played legato
+                bool legato = assigned_notes[chn] != 0;
                 stop_note(chn);
-                play_note(chn, note);
+                start_note(chn, note, legato, groups[group].velocity);
             }
         }
     }
 
     else {
-        // Find next to take note
-        uint8_t chn = 0xFF;
-        uint8_t lowest = 0xFF;
-        for (uint8_t i = 0; i < 5; i++) {
-            if (!has_member(group, i))
-                continue;
+        uint8_t chn = allocate_channel(group, is_upper);
 
-            if (assigner_split &&
-                ((is_upper && !(assigner_upper_mask[i])) ||
-                 (!is_upper && (assigner_upper_mask[i]))))
-                continue;
-
-            if (lowest == 0xFF)
-                lowest = i;
+        // No channels are assigned to this half of the MIDI keyboard
+        if (chn == 0xFF)
+            return;
 
-            if (!assigned_notes[i]) {
-                chn = i;
-                break;
-            }
+        if (assigned_notes[chn])
+            stop_note(chn);
+        unison_clear(chn);
+
+        voice_channels[chn] = note_midi_channel;
+        if (assigner_mpe_member(note_midi_channel)) {
+            // Take on the expression of the note's member channel
+            if (chn <= CHN_TRI)
+                mod_pitchbend_input[chn] = mpe_bends[note_midi_channel - MPE_MASTER_CHANNEL - 1];
+            mod_aftertouch[chn] = 0;
+            mod_timbre[chn] = 0;
         }
 
-        // If we found no lowest channel, there are no channels
-        // assigned to this half of the MIDI keyboard
-        if (lowest == 0xFF)
-            return;
+        start_note(chn, note, assigned_notes[chn] != 0, groups[group].velocity);
+    }
+}
 
-        // Take the lowest found if all have assigned notes
-        if (chn == 0xFF) {
-            chn = lowest;
-            stop_note(chn);
+static inline uint8_t channel_level(uint8_t chn)
+/* Current output level of a channel, 0 to 15 */
+{
+    switch (chn) {
+    case CHN_SQ1:
+        return env[0].value;
+    case CHN_SQ2:
+        return env[mod_sq2_env].value;
+    case CHN_TRI:
+        return tri.silenced ? 0 : 15;
+    case CHN_NOISE:
+        return env[2].value;
+    default:
+        return dmc.sample_enabled ? 15 : 0;
+    }
+}
+
+static inline uint16_t channel_score(uint8_t chn)
+/*
+  Ranks a channel for taking a new note, higher is better. Free channels
+  always rank above busy ones. Unless round robin is used, free channels
+  that have gone silent are preferred over those still in release, and
+  the quietest and oldest of those are preferred.
+*/
+{
+    uint8_t age = note_count - note_stamps[chn];
+    uint8_t quietness = 15 - channel_level(chn);
+
+    if (!assigned_notes[chn]) {
+        if (assigner_policy == ROUND_ROBIN)
+            return 0x8000;
+        return 0x8000 | (uint16_t)quietness << 8 | age;
+    }
+
+    switch (assigner_policy) {
+    case STEAL_QUIETEST:
+        return (uint16_t)quietness << 8 | age;
+    case ROUND_ROBIN:
+        return 0;
+    default:
+        return age;
+    }
+}
+
+static inline uint8_t allocate_channel(int8_t group, bool is_upper)
+/*
+  Finds the channel in the group to play a new note in polyphonic mode.
+  Channels are searched starting after the one last allocated in the same
+  half of the keyboard, so equally ranked channels are taken in turn.
+*/
+{
+    uint8_t *last = is_upper ? &groups[group].last_assigned_upper : &groups[group].last_assigned_lower;
+    uint8_t best = 0xFF;
+    uint16_t best_score = 0;
+
+    uint8_t chn = *last;
+    for (uint8_t i = 0; i < 5; i++) {
+        if (++chn == 5)
+            chn = 0;
+
+        if (!has_member(group, chn))
+            continue;
+
+        if (assigner_split &&
+            ((is_upper && !(assigner_upper_mask[chn])) ||
+             (!is_upper && (assigner_upper_mask[chn]))))
+            continue;
+
+        uint16_t score = channel_score(chn);
+        if (best == 0xFF || score > best_score) {
+            best = chn;
+            best_score = score;
         }
-        play_note(chn, note);
     }
+
+    if (best != 0xFF)
+        *last = best;
+
+    return best;
+}
+
+static inline bool group_playing(int8_t group, uint8_t note)
+{
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (has_member(group, chn) && assigned_notes[chn] == note)
+            return true;
+    }
+    return false;
+}
+
+static inline uint8_t held_note(int8_t group, bool is_upper, bool unplayed)
+/*
+  Finds the most recently played note still held in the given half of
+  the keyboard, optionally only among notes that have no channel.
+*/
+{
+    uint8_t midi_channel = groups[group].midi_channel;
+
+    for (uint8_t i = note_stack_last(midi_channel); i != NOTE_STACK_END; i = note_stack_prev(i)) {
+        uint8_t note = note_stack_note(i);
+        if (assigner_split && ((note >= assigner_split_point) != is_upper))
+            continue;
+        if (unplayed && group_playing(group, note))
+            continue;
+        return note;
+    }
+    return NOTE_STACK_END;
 }
 
 static inline void group_notify_note_off(int8_t group, uint8_t note)
+/*
+  Releases the channels playing the note. In monophonic mode the channels
+  return to the last note still held, played legato. In polyphonic mode a
+  freed channel is given to the last held note that has lost its channel.
+*/
 {
+    bool is_upper = note >= assigner_split_point;
+    bool mono = is_mono(is_upper);
+
     for (uint8_t chn = 0; chn < 5; chn++) {
-        if (has_member(group, chn)) {
-            if (assigned_notes[chn] == note)
-                stop_note(chn);
+        if (!has_member(group, chn) || assigned_notes[chn] != note)
+            continue;
+
+        // The same note may be held on several MPE member channels
+        if (assigner_mpe_member(note_midi_channel) && voice_channels[chn] != note_midi_channel)
+            continue;
+
+        // Samples are not replayed when returning to a held note, and MPE
+        // notes keep to the channel they were started on
+        bool keep = chn == CHN_DMC || assigner_mpe_member(note_midi_channel);
+        uint8_t next = keep ? NOTE_STACK_END : held_note(group, is_upper, !mono);
+
+        if (next == NOTE_STACK_END)
+            stop_note(chn);
+        else if (mono)
+            start_note(chn, next, true, groups[group].velocity);
+        else {
+            stop_note(chn);
+            start_note(chn, next, false, groups[group].velocity);
         }
     }
 }
@@ -257,27 +573,39 @@ int8_t midi_note_to_note(uint8_t midi_note)
 }
 
 void play_note(uint8_t channel, uint8_t midi_note)
+/* Plays a note at full velocity, for notes not coming from MIDI */
+{
+    unison_clear(channel);
+    start_note(channel, midi_note, assigned_notes[channel] != 0, 127);
+}
+
+static void start_note(uint8_t channel, uint8_t midi_note, bool legato, uint8_t velocity)
 {
     if (!assigner_enabled[channel])
         return;
 
     uint8_t note = midi_note_to_note(midi_note);
     assigned_notes[channel] = midi_note;
+    note_stamps[channel] = ++note_count;
+    mod_velocity[channel] = velocity;
+
+    if (channel < MACRO_VOICES)
+        macro_note_on(channel);
 
     switch (channel) {
     case CHN_SQ1:
         env[0].gate = 1;
-        portamento_target_notes[0] = note;
+        portamento_note_on(0, note, legato);
         break;
 
     case CHN_SQ2:
-        env[1].gate = 1;
-        portamento_target_notes[1] = note;
+        env[mod_sq2_env].gate = 1;
+        portamento_note_on(1, note, legato);
         break;
 
     case CHN_TRI:
         tri.silenced = 0;
-        portamento_target_notes[2] = note;
+        portamento_note_on(2, note, legato);
         break;
 
     case CHN_NOISE:
@@ -303,7 +631,7 @@ void stop_note(uint8_t channel)
         break;
 
     case CHN_SQ2:
-        env[1].gate = 0;
+        env[mod_sq2_env].gate = 0;
         break;
 
     case CHN_TRI:
@@ -318,5 +646,8 @@ void stop_note(uint8_t channel)
         dmc.sample_enabled = 0;
     }
 
+    if (channel < MACRO_VOICES)
+        macro_note_off(channel);
+
     assigned_notes[channel] = 0;
 }
@@ -28,6 +28,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Note number used for aftertouch applying to all notes on a channel
+#define ASSIGNER_ALL_NOTES 0xFF
+
+// MPE lower zone: the master channel, followed by the member channels
+#define MPE_MASTER_CHANNEL 1
+
 uint16_t note_to_period(uint8_t channel, uint8_t note);
 void play_note(uint8_t channel, uint8_t note);
 void stop_note(uint8_t channel);
@@ -35,6 +41,12 @@ void stop_note(uint8_t channel);
 void assigner_setup(void);
 void assigner_notify_note_on(uint8_t midi_channel, uint8_t note);
 void assigner_notify_note_off(uint8_t midi_channel, uint8_t note);
+void assigner_notify_velocity(uint8_t midi_channel, uint8_t velocity);
+void assigner_notify_aftertouch(uint8_t midi_channel, uint8_t note, uint8_t pressure);
+void assigner_mpe_configure(uint8_t members);
+bool assigner_mpe_member(uint8_t midi_channel);
+uint8_t assigner_mpe_voices(uint8_t midi_channel);
+void assigner_mpe_bend(uint8_t midi_channel, uint16_t bend);
 void assigner_midi_channel_change(uint8_t midi_channel, uint8_t chn);
 uint8_t assigner_midi_channel_get(uint8_t chn);
 uint8_t assigner_channel_get(uint8_t midi_channel);
@@ -42,11 +54,22 @@ uint8_t assigner_channel_get(uint8_t midi_channel);
 enum assigner_mode {
     MONO,
     POLY,
+    UNISON,      // As MONO, with stacked pitched channels spread in pitch
+};
+
+/* Which voice to take in polyphonic mode when all voices are playing */
+enum assigner_policy {
+    STEAL_OLDEST,
+    STEAL_QUIETEST,
+    ROUND_ROBIN,
 };
 
 extern enum assigner_mode assigner_lower_mode;
 extern enum assigner_mode assigner_upper_mode;
+extern enum assigner_policy assigner_policy;
 extern bool assigner_split;
 extern int8_t assigner_split_point;
 extern int8_t assigner_upper_mask[5];
 extern int8_t assigner_enabled[5];
+extern uint8_t assigned_notes[5];
+extern uint8_t assigner_mpe_members;
@@ -25,6 +25,7 @@
 
 
 #include "envelope/envelope.h"
+#include "modulation/modulation.h"
 
 struct envelope env[3];
 
@@ -120,6 +121,10 @@ void envelope_update(struct envelope* env)
 void envelope_update_handler()
 {
   envelope_update(&env[0]);
-  envelope_update(&env[1]);
+
+  // SQ2 uses the SQ1 envelope while both squares are stacked in unison
+  if (mod_sq2_env != 0)
+    envelope_update(&env[1]);
+
   envelope_update(&env[2]);
 }
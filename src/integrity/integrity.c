@@ -0,0 +1,296 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Memory integrity
+
+  Keeps a CRC for each region of stored data in SRAM (settings, sample
+  index, block table, patches and patterns), and checks them in the
+  background. A region found damaged is reset to its initial state.
+
+  After a corrupt RAM startup, the regions are formatted by the same
+  task instead of at startup, so the NESIZER can be played right away.
+  A region that is used before its turn is formatted there and then.
+*/
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <util/crc16.h>
+#include "integrity.h"
+#include "io/memory.h"
+#include "settings/settings.h"
+#include "sample/sample.h"
+#include "modulation/periods.h"
+
+/*
+  The table starts with a tag, followed by a bitmap of the regions that
+  have been written since their CRC was last computed, a bitmap of the
+  regions still to be formatted, and the CRCs.
+
+  Code writing to a region marks it as stale before it starts writing,
+  and the background check computes a new CRC for stale regions instead
+  of verifying them. The bitmaps are only kept in SRAM, so that a region
+  written just before power was lost isn't taken to be damaged, and the
+  RAM is left for the patch cache. Only whether any region is left to be
+  formatted is kept in RAM, so that the usual check before reading a
+  region doesn't have to go to SRAM.
+*/
+#define TAG 0x43524332
+#define TAG_ADDRESS MEMORY_INTEGRITY_START
+#define BITMAP_SIZE ((INTEGRITY_NUM_REGIONS + 7) / 8)
+#define STALE_ADDRESS (TAG_ADDRESS + 4)
+#define UNFORMATTED_ADDRESS (STALE_ADDRESS + BITMAP_SIZE)
+#define CRC_ADDRESS (UNFORMATTED_ADDRESS + BITMAP_SIZE)
+
+_Static_assert(CRC_ADDRESS + 2 * INTEGRITY_NUM_REGIONS <= SAMPLE_INDEX_START,
+               "CRC table overlaps the sample index");
+
+// Number of bytes checked each time the handler runs
+#define CHUNK 32
+
+#define NO_REGION 0xFF
+
+uint16_t integrity_repairs;
+bool integrity_formatting;
+
+// Writes are only tracked once the table is set up. Before that, its
+// place may still hold data of an older memory layout being moved.
+static bool tracking;
+
+static uint8_t sweep;
+static uint8_t region = NO_REGION;
+static uint16_t offset;
+static uint16_t crc;
+
+static void region_span(uint8_t num, uint32_t *address, uint16_t *size)
+{
+    if (num == INTEGRITY_SETTINGS) {
+        *address = SETTINGS_BASE_ADDRESS;
+        *size = SETTINGS_SIZE;
+    }
+    else if (num == INTEGRITY_SAMPLE_INDEX) {
+        *address = SAMPLE_INDEX_START;
+        *size = SAMPLE_INDEX_SIZE;
+    }
+    else if (num == INTEGRITY_BLOCK_TABLE) {
+        *address = SAMPLE_BLOCKTABLE_START;
+        *size = SAMPLE_BLOCKTABLE_SIZE;
+    }
+    else if (num < INTEGRITY_PATTERN(0)) {
+        *address = PATCH_START + (uint32_t)PATCH_SIZE * (num - INTEGRITY_PATCH(0));
+        *size = PATCH_SIZE;
+    }
+    else {
+        *address = MEMORY_PATTERN_START + (uint32_t)SEQUENCER_PATTERN_SIZE * (num - INTEGRITY_PATTERN(0));
+        *size = SEQUENCER_PATTERN_SIZE;
+    }
+}
+
+static void reset_region(uint8_t num)
+/* Resets a region to its initial state */
+{
+    if (num == INTEGRITY_SETTINGS) {
+        settings_init();
+        periods_setup();
+    }
+    else if (num == INTEGRITY_SAMPLE_INDEX || num == INTEGRITY_BLOCK_TABLE)
+        // The index and the block table only make sense together
+        sample_clear_all();
+    else if (num < INTEGRITY_PATTERN(0))
+        patch_initialize(num - INTEGRITY_PATCH(0));
+    else
+        sequencer_pattern_clear(num - INTEGRITY_PATTERN(0));
+}
+
+static inline bool bit_set(uint32_t address, uint8_t num)
+{
+    return memory_read(address + num / 8) & (1 << (num % 8));
+}
+
+static void set_bit(uint32_t address, uint8_t num, bool value)
+/* Changes a bit in one of the bitmaps */
+{
+    uint8_t old = memory_read(address + num / 8);
+    uint8_t byte = old;
+
+    if (value)
+        byte |= 1 << (num % 8);
+    else
+        byte &= ~(1 << (num % 8));
+
+    if (byte != old)
+        memory_write(address + num / 8, byte);
+}
+
+static uint8_t first_set(uint32_t address)
+/* Returns the lowest region set in a bitmap, or NO_REGION */
+{
+    uint8_t bitmap[BITMAP_SIZE];
+    memory_read_burst(address, bitmap, BITMAP_SIZE);
+
+    for (uint8_t i = 0; i < BITMAP_SIZE; i++) {
+        if (bitmap[i] == 0)
+            continue;
+
+        uint8_t num = i * 8;
+        while (!(bitmap[i] & (1 << (num % 8))))
+            num++;
+        return num;
+    }
+    return NO_REGION;
+}
+
+static void fill(uint32_t address, uint8_t value)
+{
+    uint8_t bitmap[BITMAP_SIZE];
+
+    for (uint8_t i = 0; i < BITMAP_SIZE; i++)
+        bitmap[i] = value;
+    if (value && INTEGRITY_NUM_REGIONS % 8)
+        bitmap[BITMAP_SIZE - 1] = (1 << (INTEGRITY_NUM_REGIONS % 8)) - 1;
+
+    memory_write_burst(address, bitmap, BITMAP_SIZE);
+}
+
+static uint8_t next_region(void)
+/* Stale regions go first, then the regions are checked in turn */
+{
+    uint8_t num = first_set(STALE_ADDRESS);
+    if (num != NO_REGION)
+        return num;
+
+    num = sweep;
+    if (++sweep == INTEGRITY_NUM_REGIONS)
+        sweep = 0;
+    return num;
+}
+
+void integrity_setup(void)
+{
+    if (memory_read_dword(TAG_ADDRESS) != TAG) {
+        integrity_reset();
+    }
+    else {
+        // Formatting interrupted by a power-off carries on where it was
+        integrity_formatting = first_set(UNFORMATTED_ADDRESS) != NO_REGION;
+        tracking = true;
+    }
+}
+
+void integrity_reset(void)
+/* Marks all regions as stale, so that all CRCs are computed anew */
+{
+    fill(STALE_ADDRESS, 0xFF);
+    fill(UNFORMATTED_ADDRESS, 0);
+    integrity_formatting = false;
+    memory_write_dword(TAG_ADDRESS, TAG);
+    region = NO_REGION;
+    tracking = true;
+}
+
+void integrity_format(void)
+/*
+  Marks the settings, patches and patterns to be formatted in the
+  background. The sample index is left as it is.
+*/
+{
+    fill(UNFORMATTED_ADDRESS, 0xFF);
+    set_bit(UNFORMATTED_ADDRESS, INTEGRITY_SAMPLE_INDEX, false);
+    set_bit(UNFORMATTED_ADDRESS, INTEGRITY_BLOCK_TABLE, false);
+    integrity_formatting = true;
+}
+
+bool integrity_formatted(uint8_t num)
+/* Tells if a region has been formatted, or holds data kept from before */
+{
+    return !integrity_formatting || !bit_set(UNFORMATTED_ADDRESS, num);
+}
+
+void integrity_require(uint8_t num)
+/* Formats a region now if it hasn't been yet. Must be called before reading it. */
+{
+    if (integrity_formatted(num))
+        return;
+
+    // Cleared first, since formatting writes to the region
+    set_bit(UNFORMATTED_ADDRESS, num, false);
+    reset_region(num);
+}
+
+void integrity_touch(uint8_t num)
+/* Marks a region as stale. Must be called before writing to it. */
+{
+    if (!tracking)
+        return;
+
+    // Data written to a region that isn't formatted would be mixed with garbage
+    integrity_require(num);
+
+    // A check of the region in progress would see a mix of old and new data
+    if (num == region)
+        region = NO_REGION;
+
+    set_bit(STALE_ADDRESS, num, true);
+}
+
+void integrity_handler(void)
+{
+    if (integrity_formatting) {
+        uint8_t pending = first_set(UNFORMATTED_ADDRESS);
+        if (pending != NO_REGION) {
+            integrity_require(pending);
+            return;
+        }
+        integrity_formatting = false;
+    }
+
+    if (region == NO_REGION) {
+        region = next_region();
+        offset = 0;
+        crc = 0xFFFF;
+    }
+
+    uint32_t address;
+    uint16_t size;
+    region_span(region, &address, &size);
+
+    uint8_t buffer[CHUNK];
+    uint8_t length = (size - offset < CHUNK) ? size - offset : CHUNK;
+    memory_read_burst(address + offset, buffer, length);
+
+    for (uint8_t i = 0; i < length; i++)
+        crc = _crc_ccitt_update(crc, buffer[i]);
+
+    offset += length;
+    if (offset < size)
+        return;
+
+    uint8_t num = region;
+    region = NO_REGION;
+
+    if (bit_set(STALE_ADDRESS, num)) {
+        memory_write_word(CRC_ADDRESS + 2 * num, crc);
+        set_bit(STALE_ADDRESS, num, false);
+    }
+    else if (memory_read_word(CRC_ADDRESS + 2 * num) != crc) {
+        integrity_repairs++;
+        reset_region(num);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Memory integrity
+
+  Keeps a CRC for each region of stored data in SRAM (settings, sample
+  index, block table, patches and patterns), and checks them in the
+  background. A region found damaged is reset to its initial state.
+
+  After a corrupt RAM startup, the regions are formatted by the same
+  task instead of at startup, so the NESIZER can be played right away.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "patch/patch.h"
+#include "sequencer/sequencer.h"
+
+#define INTEGRITY_SETTINGS 0
+#define INTEGRITY_SAMPLE_INDEX 1
+#define INTEGRITY_BLOCK_TABLE 2
+#define INTEGRITY_PATCH(num) (3 + (num))
+#define INTEGRITY_PATTERN(num) (INTEGRITY_PATCH(PATCH_MAX + 1) + (num))
+#define INTEGRITY_NUM_REGIONS INTEGRITY_PATTERN(SEQUENCER_NUM_PATTERNS)
+
+extern uint16_t integrity_repairs;
+
+// Set while there are regions left to be formatted
+extern bool integrity_formatting;
+
+void integrity_setup(void);
+void integrity_reset(void);
+void integrity_format(void);
+bool integrity_formatted(uint8_t region);
+void integrity_require(uint8_t region);
+void integrity_touch(uint8_t region);
+void integrity_handler(void);
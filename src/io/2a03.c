@@ -78,6 +78,8 @@ uint8_t io_clockdiv;
 */
 static inline void register_write(uint8_t reg, uint8_t value)
 {
+    uint8_t previous = bus_begin(BUS_2A03);
+
     // Put STA_zp on bus before deactivating CPU latch
     bus_write(STA_zp);
 
@@ -96,6 +98,8 @@ static inline void register_write(uint8_t reg, uint8_t value)
 
     // Reflect change in mirror
     reg_mirror[reg] = value;
+
+    bus_end(previous);
 }
 
 
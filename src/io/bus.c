@@ -26,6 +26,12 @@
 
 #include <avr/io.h>
 #include "io/bus.h"
+#include "task/task.h"
+
+uint8_t bus_owner = BUS_IDLE;
+
+// Transactions refused since one of the same or higher priority held the bus
+uint16_t bus_conflicts;
 
 void bus_setup(void)
 {
@@ -36,3 +42,39 @@ void bus_setup(void)
     // correctly:
     bus_dir_output();
 }
+
+uint8_t bus_begin(uint8_t priority)
+/*
+  Starts a transaction, and returns the owner it interrupted, which is
+  given back to bus_end. Returns BUS_REFUSED without starting it if the
+  bus is held at the same or a higher priority, and bus_end must then
+  not be called.
+*/
+{
+    uint8_t previous = bus_owner;
+
+    if (previous != BUS_IDLE && priority <= previous) {
+        bus_conflicts++;
+        return BUS_REFUSED;
+    }
+
+    bus_owner = priority;
+    return previous;
+}
+
+void bus_end(uint8_t previous)
+{
+    bus_owner = previous;
+}
+
+void bus_yield(void)
+/*
+  Called between the bytes of a long transaction. Lets the DMC fetch its
+  next sample byte if it is due, so that sample playback keeps its rate
+  while large blocks are copied. The caller has to set up its address
+  latches again afterwards.
+*/
+{
+    if (bus_owner < BUS_DMC)
+        task_yield();
+}
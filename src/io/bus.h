@@ -89,5 +89,32 @@
     PORTC &= ~DATA_PORTC_m;                     \
     DDRC |= DATA_PORTC_m
 
+/*
+  Bus users, in order of increasing priority. Each use of the bus is a
+  transaction, which may only be interrupted by one of higher priority.
+  A transaction started while the bus is held at the same or a higher
+  priority is refused, and the panel and the DMC try again on their
+  next run. Since the tasks take turns, the only interruption that
+  happens is a long SRAM transfer giving way to the DMC sample fetch
+  between bytes.
+*/
+enum bus_priority {
+    BUS_IDLE,
+    BUS_PANEL,            // LED and switch scanning
+    BUS_SRAM_BULK,        // Block transfers to and from SRAM
+    BUS_DMC,              // Sample fetches for the DMC
+    BUS_2A03              // APU register writes
+};
+
+// Returned by bus_begin for a refused transaction
+#define BUS_REFUSED 0xFF
+
+extern uint8_t bus_owner;
+extern uint16_t bus_conflicts;
+
 // Setup function
 void bus_setup(void);
+
+uint8_t bus_begin(uint8_t priority);
+void bus_end(uint8_t previous);
+void bus_yield(void);
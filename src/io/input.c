@@ -20,7 +20,7 @@
 
   Button io/input.handling
 
-  Reads button states
+  Reads button states, and turns changes in them into a queue of events
 */
 
 
@@ -31,6 +31,60 @@
 
 uint8_t input[3]; 
 
+/*
+  Events are queued as the debounced button states change, stamped with
+  the time they were seen at
+*/
+#define QUEUE_SIZE 8
+
+static struct input_event queue[QUEUE_SIZE];
+static uint8_t queue_read;
+static uint8_t queue_count;
+
+static uint16_t time;
+
+static void push_event(uint8_t button, uint8_t type)
+{
+    // The oldest events are kept if the queue is full, since a release
+    // can then still be paired with its press
+    if (queue_count == QUEUE_SIZE)
+        return;
+
+    uint8_t pos = (queue_read + queue_count) % QUEUE_SIZE;
+    queue[pos] = (struct input_event) {.button = button, .type = type, .time = time};
+    queue_count++;
+}
+
+static void detect_edges(uint8_t row, uint8_t previous, uint8_t current)
+{
+    uint8_t changed = previous ^ current;
+
+    for (uint8_t col = 0; changed != 0; col++, changed >>= 1) {
+        if (!(changed & 1))
+            continue;
+
+        push_event(row * 8 + col, (current & (1 << col)) ? INPUT_PRESS : INPUT_RELEASE);
+    }
+}
+
+uint16_t input_time(void)
+/* Returns the time in the units of the event stamps */
+{
+    return time;
+}
+
+uint8_t input_event_read(struct input_event *event)
+/* Takes the oldest event from the queue. Returns 0 if it is empty. */
+{
+    if (queue_count == 0)
+        return 0;
+
+    *event = queue[queue_read];
+    queue_read = (queue_read + 1) % QUEUE_SIZE;
+    queue_count--;
+    return 1;
+}
+
 void input_refresh(void) 
 /* Reads one column of switch data each time it is called and auto-increments
    the current row
@@ -39,7 +93,14 @@ void input_refresh(void)
     static uint8_t current_row = 0;
     static uint8_t stage = 0;
     static uint8_t last_data = 0;
+
+    time++;
     
+    // The row is scanned on the next call if the bus is taken
+    uint8_t previous = bus_begin(BUS_PANEL);
+    if (previous == BUS_REFUSED)
+        return;
+
     // Update row latch value
     bus_select(ROW_ADDRESS);
     bus_write(row_mirror | (0x20 << current_row));
@@ -52,13 +113,18 @@ void input_refresh(void)
     uint8_t switch_data = bus_read();
     bus_dir_output();
     bus_deselect();
+
+    bus_end(previous);
     
     if (stage == 1) {	
 	// Expand the switch bits into individual bytes in the input array
       uint8_t* row = &input[current_row];
+      uint8_t previous = *row;
 
       // Debouncing:
       *row = (switch_data & *row) | (switch_data & last_data) | (last_data & *row);
+
+      detect_edges(current_row, previous, *row);
       
       if (++current_row == 3) 
 	    current_row = 0;
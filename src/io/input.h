@@ -28,6 +28,28 @@
 
 #include <stdint.h>
 
+#define INPUT_NO_BUTTON 0xFF
+
+/*
+  Only presses and releases are queued. The UI makes the hold and repeat
+  events of the button pressed last from the time of its press.
+*/
+enum input_event_type {
+    INPUT_PRESS,
+    INPUT_RELEASE,
+    INPUT_HOLD,           // Held down since the press, for about 300 ms
+    INPUT_REPEAT,         // Still held, about every 55 ms after the hold
+    INPUT_NONE
+};
+
+struct input_event {
+    uint8_t button;
+    uint8_t type;
+    uint16_t time;        // In input_refresh calls, 5 ms each
+};
+
 extern uint8_t input[3];
 
 void input_refresh(void);
+uint8_t input_event_read(struct input_event *event);
+uint16_t input_time(void);
@@ -26,6 +26,8 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
 #include "io/leds.h"
 #include "io/bus.h"
 
@@ -54,7 +56,7 @@ uint8_t row_mirror;
 #define SYM_DOT 0b00000001
 #define SYM_MINUS 0b00000010
 
-static const uint8_t leds_7seg_values[19] = {
+static const uint8_t leds_7seg_values[19] PROGMEM = {
     SYM_0,
     SYM_1,
     SYM_2,
@@ -73,50 +75,110 @@ static const uint8_t leds_7seg_values[19] = {
     SYM_F
 };
 
+/*
+  The LEDs are scanned one column and half of the rows at a time. The row
+  values for each of these slots are worked out only when leds[] has
+  changed, so that the scan is a walk through the table. A slot where all
+  LEDs are off following another such slot leaves the latches as they
+  are, since nothing is lit either way.
+*/
+#define NUM_SLOTS 16
+
+#define ROWS_OFF 0x1F
+
+uint16_t leds_skipped_slots;
+
+static uint8_t slot_rows[NUM_SLOTS] = {[0 ... NUM_SLOTS - 1] = ROWS_OFF};
+static uint8_t leds_shadow[5];
+
+static void build_slots(void)
+{
+    for (uint8_t i = 0; i < 5; i++)
+        leds_shadow[i] = leds[i];
+
+    uint8_t col = 1;
+    for (uint8_t slot = 0; slot < NUM_SLOTS; slot += 2) {
+        slot_rows[slot] = ROWS_OFF & ~(isone(leds[0] & col)
+                                       | (isone(leds[1] & col) << 1)
+                                       | (isone(leds[2] & col) << 2));
+        slot_rows[slot + 1] = ROWS_OFF & ~((isone(leds[3] & col) << 3)
+                                           | (isone(leds[4] & col) << 4));
+        col <<= 1;
+    }
+}
+
+static inline bool leds_changed(void)
+{
+    for (uint8_t i = 0; i < 5; i++) {
+        if (leds[i] != leds_shadow[i])
+            return true;
+    }
+    return false;
+}
+
 void leds_refresh(void)
 /* This function is intended to be called by the task/task.handler
    at a given frequency. Each time it is called, a new LED column
    is displayed.
 */
 {
-    static uint8_t current_col = 1;
-    static uint8_t current_row_half = 0;
-
-    // Fetch LED status for the rows in the current column
-    if (current_row_half == 0) {
-        row_mirror = 0x1F & ~(isone(leds[0] & current_col)
-                              | (isone(leds[1] & current_col) << 1)
-                              | (isone(leds[2] & current_col) << 2));
+    static uint8_t slot = 0;
+    static uint8_t latched_rows = ROWS_OFF;
+    static uint16_t skipped = 0;
+    static uint16_t count = 0;
+
+    if (slot == 0 && leds_changed())
+        build_slots();
+
+    uint8_t col_index = slot / 2;
+    row_mirror = slot_rows[slot];
+
+    if (row_mirror == ROWS_OFF && latched_rows == ROWS_OFF) {
+        skipped++;
     }
     else {
-        row_mirror = 0x1F & ~((isone(leds[3] & current_col) << 3)
-                              | (isone(leds[4] & current_col) << 4));
-    }
+        // The slot is shown on the next call if the bus is taken
+        uint8_t previous = bus_begin(BUS_PANEL);
+        if (previous == BUS_REFUSED) {
+            row_mirror = latched_rows;
+            return;
+        }
 
-    // Address the row latch and put on bus
-    bus_select(ROW_ADDRESS);
+        // Address the row latch and put on bus
+        bus_select(ROW_ADDRESS);
 
-    bus_write(row_mirror);
+        bus_write(row_mirror);
 
-    bus_deselect();
+        bus_deselect();
 
-    // Switch to column latch, the row value is latched when this happens
-    bus_select(LEDCOL_ADDRESS);
+        // Switch to column latch, the row value is latched when this happens
+        bus_select(LEDCOL_ADDRESS);
 
-    // Activate desired column
-    bus_write(current_col);
+        // Activate desired column
+        bus_write(1 << col_index);
 
-    // Deselect to latch the value
-    bus_deselect();
+        // Deselect to latch the value
+        bus_deselect();
 
-    if (current_row_half == 1)
-        current_col = (current_col == 0x80) ? 1 : current_col << 1;
-    current_row_half ^= 1;
+        latched_rows = row_mirror;
+
+        bus_end(previous);
+    }
+
+    if (++slot == NUM_SLOTS)
+        slot = 0;
+
+    // Number of scan slots skipped over the last second
+    if (++count == LEDS_REFRESH_RATE) {
+        leds_skipped_slots = skipped;
+        skipped = 0;
+        count = 0;
+    }
 }
 
 void leds_7seg_set(uint8_t row, uint8_t val)
 {
-    leds[row] = leds_7seg_values[val];
+    leds[row] = pgm_read_byte(&leds_7seg_values[val]);
 }
 
 void leds_7seg_minus(uint8_t row)
@@ -155,7 +217,7 @@ void leds_7seg_two_digit_set(uint8_t row1, uint8_t row2, uint8_t value)
 
 void leds_7seg_note_set(uint8_t row1, uint8_t row2, uint8_t note)
 {
-    static const uint8_t note_symbols[] = {
+    static const uint8_t note_symbols[] PROGMEM = {
         SYM_C,
         SYM_d | SYM_DOT,
         SYM_d,
@@ -170,7 +232,7 @@ void leds_7seg_note_set(uint8_t row1, uint8_t row2, uint8_t note)
         SYM_b
     };
 
-    leds[row1] = note_symbols[note % 12];
+    leds[row1] = pgm_read_byte(&note_symbols[note % 12]);
     leds_7seg_set(row2, note / 12 - 1);
 }
 
@@ -40,9 +40,13 @@
 #define LEDS_7SEG_DOT 17
 #define LEDS_7SEG_MINUS 18
 
+// Calls of leds_refresh per second
+#define LEDS_REFRESH_RATE 801
+
 // Global variables
 extern uint8_t leds[5];
 extern uint8_t row_mirror;
+extern uint16_t leds_skipped_slots;
 
 // Functions
 void leds_refresh(void);
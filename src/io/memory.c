@@ -44,16 +44,36 @@ union val16 {
 struct memory_context default_context;
 struct memory_context *current_context;
 
+// Used by the block transfers, which may be interrupted by the DMC using
+// the default context
+static struct memory_context bulk_context;
+
+/*
+  The values last written to the low and mid address latches. When an
+  address is set up or a context is switched to, only the latches
+  holding a different value are written. The high latch also holds the
+  chip selects, so it is written for every access anyway, and is left
+  out of the latch write counts.
+*/
+static uint8_t latched_low;
+static uint8_t latched_mid;
+
+// Low and mid latch writes done and avoided when setting up addresses
+uint16_t memory_latch_writes;
+uint16_t memory_latch_writes_avoided;
+
 // Functions for writing to each of the three address latches
 
 static inline void set_addrlow(uint8_t addrlow)
 {
+  latched_low = addrlow;
   bus_select(MEMORY_LOW_ADDRESS);
   bus_write(addrlow);
 }
 
 static inline void set_addrmid(uint8_t addrmid)
 {
+  latched_mid = addrmid;
   bus_select(MEMORY_MID_ADDRESS);
   bus_write(addrmid);
 }
@@ -72,6 +92,35 @@ static inline void set_addrhigh(uint8_t addrhigh)
   bus_write((addrhigh & 0x07) | ((addrhigh & 0x08) ? 0b01000 : 0b10000));
 }
 
+static inline void count_latch_write(uint16_t *counter)
+{
+  // Both counts are halved before one overflows, keeping their ratio
+  if (++*counter == 0xFFFF) {
+    memory_latch_writes >>= 1;
+    memory_latch_writes_avoided >>= 1;
+  }
+}
+
+static inline void update_addrlow(uint8_t addrlow)
+{
+  if (addrlow == latched_low) {
+    count_latch_write(&memory_latch_writes_avoided);
+    return;
+  }
+  count_latch_write(&memory_latch_writes);
+  set_addrlow(addrlow);
+}
+
+static inline void update_addrmid(uint8_t addrmid)
+{
+  if (addrmid == latched_mid) {
+    count_latch_write(&memory_latch_writes_avoided);
+    return;
+  }
+  count_latch_write(&memory_latch_writes);
+  set_addrmid(addrmid);
+}
+
 static void inc_address(void)
 {
   set_addrlow(++current_context->low);
@@ -144,9 +193,9 @@ static inline void write_sequential(uint8_t value)
 
 static void apply_context(struct memory_context *context)
 {
-  set_addrlow(context->low);
-  set_addrmid(context->mid);
-  set_addrhigh(context->high);
+  update_addrlow(context->low);
+  update_addrmid(context->mid);
+
   current_context = context;
 }
 
@@ -168,10 +217,10 @@ void memory_set_address(struct memory_context *context, uint32_t address)
   union val32 addr = {.value = address};
 
   // Put first 8 address bits in low address latch:
-  set_addrlow(context->low = addr.bytes[0]);
+  update_addrlow(context->low = addr.bytes[0]);
 
   // Put next 8 address bits in mid address latch:
-  set_addrmid(context->mid = addr.bytes[1]);
+  update_addrmid(context->mid = addr.bytes[1]);
 
   // Put next 4 address bits in high address latch.
   // The final bit decides between the first and second memory bank.
@@ -211,6 +260,40 @@ void memory_write_sequential(struct memory_context *context, uint8_t value)
   write_sequential(value);
 }
 
+void memory_read_burst(uint32_t address, uint8_t *buffer, uint16_t length)
+/*
+  Reads a block of bytes into a buffer. The address is only set up once,
+  so this is much faster than reading each byte separately. The DMC may
+  fetch samples in between the bytes, after which the address latches
+  are set up again.
+*/
+{
+  uint8_t previous = bus_begin(BUS_SRAM_BULK);
+
+  memory_set_address(&bulk_context, address);
+  for (uint16_t i = 0; i < length; i++) {
+    bus_yield();
+    check_context(&bulk_context);
+    buffer[i] = read_sequential();
+  }
+
+  bus_end(previous);
+}
+
+void memory_write_burst(uint32_t address, const uint8_t *buffer, uint16_t length)
+{
+  uint8_t previous = bus_begin(BUS_SRAM_BULK);
+
+  memory_set_address(&bulk_context, address);
+  for (uint16_t i = 0; i < length; i++) {
+    bus_yield();
+    check_context(&bulk_context);
+    write_sequential(buffer[i]);
+  }
+
+  bus_end(previous);
+}
+
 void memory_write_word(uint32_t address, uint16_t value)
 {
   memory_set_address(&default_context, address);
@@ -265,6 +348,11 @@ void memory_setup(void)
   // Make sure the upper address latch is driving CE1 and CE2 high (not asserted)
   deselect();
 
+  // Give the other latches known values
+  set_addrlow(0);
+  set_addrmid(0);
+  bus_deselect();
+
   // Set WE high (not asserted)
   PORTC |= WE;
   DDRC |= WE;
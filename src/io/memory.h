@@ -37,6 +37,15 @@
 
 #define MEMORY_SIZE 0x100000UL  // 1MB of memory
 
+// The top 192 KB is reserved for sequencer patterns and patches and is
+// not used for samples
+#define MEMORY_RESERVED_START 0xD0000UL
+#define MEMORY_PATTERN_START 0xD0000UL
+#define MEMORY_PATCH_START 0xF0000UL
+
+// CRC table for the stored regions, in the otherwise unused low memory
+#define MEMORY_INTEGRITY_START 0x100UL
+
 /*
    The memory context is needed to perform sequential operations while the
    memory is shared by several tasks.
@@ -57,8 +66,13 @@ uint8_t memory_read(uint32_t address);
 uint16_t memory_read_word(uint32_t address);
 uint32_t memory_read_dword(uint32_t address);
 uint8_t memory_read_sequential(struct memory_context *context);
+void memory_read_burst(uint32_t address, uint8_t *buffer, uint16_t length);
+void memory_write_burst(uint32_t address, const uint8_t *buffer, uint16_t length);
 void memory_write_sequential(struct memory_context *context, uint8_t value);
 
+extern uint16_t memory_latch_writes;
+extern uint16_t memory_latch_writes_avoided;
+
 void memory_setup(void);
 void memory_clean(void);
 
@@ -22,14 +22,17 @@
 
   Performs the low level functionality of receiving MIDI input. Receiving MIDI
   data is performed by the USART module of the Atmega microcontroller. Incoming
-  data is read into a ring buffer.
+  data is read into a ring buffer, and the arrival time of each message is
+  kept in a second one.
 */
 
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "midi.h"
 #include "ringbuffer.h"
+#include "task/task.h"
 
 #define BUFFER_SIZE 8
 
@@ -37,8 +40,20 @@
 static struct ring_buffer input_buffer;
 static struct ring_buffer output_buffer;
 
+/*
+  task_time() at which each status byte in the input buffer arrived, low
+  byte first. Messages are read out within a millisecond or so, well
+  before the 16 times it holds are used up.
+*/
+static struct ring_buffer time_buffer;
+
+/* Real time messages waiting to be sent ahead of the output buffer */
+#define REALTIME_SIZE 4
+static uint8_t realtime[REALTIME_SIZE];
+static uint8_t realtime_count;
+
 /* Length of messages, excluding the status byte */
-static const uint8_t message_lengths[] = {
+static const uint8_t message_lengths[] PROGMEM = {
     2, 2, 2, 2, 1, 1, 2, 0, // channel messages
     0, 1, 2, 1              // sysex messages
 };
@@ -70,7 +85,13 @@ ISR(USART_RX_vect)
     // If the RXC0 bit in UCSR0A is set, there is unread data in the receive
     // register.
     while (UCSR0A & (1 << RXC0)) {
-        ring_buffer_write(&input_buffer, UDR0);
+        uint8_t byte = UDR0;
+        if (is_status_byte(byte)) {
+            uint16_t time = task_time();
+            ring_buffer_write(&time_buffer, time & 0xFF);
+            ring_buffer_write(&time_buffer, time >> 8);
+        }
+        ring_buffer_write(&input_buffer, byte);
     }
 }
 
@@ -79,7 +100,14 @@ ISR(USART_RX_vect)
 */
 void midi_io_handler(void)
 {
-    if (ring_buffer_bytes_remaining(&output_buffer) > 0) {
+    if (realtime_count > 0) {
+        while (!(UCSR0A & (1 << UDRE0)));
+        UDR0 = realtime[0];
+        for (uint8_t i = 1; i < realtime_count; i++)
+            realtime[i - 1] = realtime[i];
+        realtime_count--;
+    }
+    else if (ring_buffer_bytes_remaining(&output_buffer) > 0) {
         while (!(UCSR0A & (1 << UDRE0)));
         UDR0 = ring_buffer_read(&output_buffer);
     }
@@ -116,6 +144,8 @@ uint8_t midi_io_read_message(struct midi_message *msg)
         return 0;
 
     msg->command = get_command(status);
+    msg->time = ring_buffer_read(&time_buffer);
+    msg->time |= (uint16_t)ring_buffer_read(&time_buffer) << 8;
 
     if (midi_is_channel_message(msg->command))
         msg->channel = get_channel(status);
@@ -131,6 +161,21 @@ uint8_t midi_io_read_message(struct midi_message *msg)
     return 1;
 }
 
+void midi_io_write_realtime(uint8_t command)
+/*
+  Sends a real time message (clock, start, stop etc.). These may be sent
+  in the middle of other messages, so they are sent right away if the
+  transmitter is free, or else before anything in the output buffer.
+*/
+{
+    uint8_t status = 0xF0 | (command - 0x08);
+
+    if (realtime_count == 0 && (UCSR0A & (1 << UDRE0)))
+        UDR0 = status;
+    else if (realtime_count < REALTIME_SIZE)
+        realtime[realtime_count++] = status;
+}
+
 void midi_io_write_message(struct midi_message msg)
 {
     uint8_t status;
@@ -155,7 +200,7 @@ static inline uint8_t message_length(uint8_t command)
     if (command >= 12)
         return 0;
     else
-        return message_lengths[command];
+        return pgm_read_byte(&message_lengths[command]);
 }
 
 static inline uint8_t is_status_byte(uint8_t byte)
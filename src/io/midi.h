@@ -57,6 +57,7 @@ struct midi_message {
     uint8_t channel;
     uint8_t data1;
     uint8_t data2;
+    uint16_t time;        // task_time() when received
 };
 
 void midi_io_setup(void);
@@ -67,4 +68,5 @@ uint8_t midi_io_read_byte(void);
 uint8_t midi_io_bytes_remaining(void);
 
 void midi_io_write_byte(uint8_t value);
+void midi_io_write_realtime(uint8_t command);
 void midi_io_write_message(struct midi_message msg);
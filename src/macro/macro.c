@@ -0,0 +1,311 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Instrument macros
+
+  Per voice volume, duty, pitch and arpeggio sequences, stepped at a
+  fixed frame rate like the instrument macros of NES music trackers.
+
+  Each macro is stored in external memory as a length, a loop point, a
+  release point and up to MACRO_MAX_LENGTH steps. The macros of the
+  current patch are kept in an edit buffer, which is copied from and to
+  the patch when it is loaded and saved. The headers are cached here, so
+  stepping a macro needs a single memory read.
+
+  Loading is spread over the following handler calls, one macro per
+  call. A macro is silent until it has been copied.
+
+  While the note is held, a macro loops from its release point back to
+  the loop point, or holds at the release point if there is no loop
+  point before it. When the note is released, it carries on past the
+  release point. At the end, a macro loops back to the loop point if it
+  comes after the release point, or else holds the last value.
+*/
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "macro/macro.h"
+#include "io/memory.h"
+#include "patch/patch.h"
+#include "settings/settings.h"
+
+#define MACRO_HEADER_SIZE 3
+
+#define EDIT_BUFFER_START (PATCH_START + (uint32_t)PATCH_SIZE * PATCH_EDIT_BUFFER + PATCH_MACRO_OFFSET)
+
+// Rate of macro_handler calls
+#define HANDLER_RATE 1602
+
+struct macro_header {
+    uint8_t length;
+    uint8_t loop;
+    uint8_t release;
+};
+
+int8_t macro_values[MACRO_VOICES][NUM_MACRO_TYPES];
+uint8_t macro_active[MACRO_VOICES];
+
+static struct macro_header headers[MACRO_VOICES][NUM_MACRO_TYPES];
+static uint8_t positions[MACRO_VOICES][NUM_MACRO_TYPES];
+static uint8_t released;
+static uint8_t pending;
+static uint8_t rate = MACRO_DEFAULT_RATE;
+
+// Macros still to be copied to the edit buffer, and where they come from
+#define NUM_MACROS (MACRO_VOICES * NUM_MACRO_TYPES)
+static uint8_t load_next = NUM_MACROS;
+static uint32_t load_address;
+
+static const int8_t neutral_values[NUM_MACRO_TYPES] = {
+    [MACRO_VOLUME] = 15,
+    [MACRO_DUTY] = 0,
+    [MACRO_PITCH] = 0,
+    [MACRO_ARPEGGIO] = 0
+};
+
+static inline uint32_t macro_offset(uint8_t voice, uint8_t type)
+{
+    return (uint16_t)(voice * NUM_MACRO_TYPES + type) * MACRO_SIZE;
+}
+
+static void set_header(uint8_t voice, uint8_t type, const uint8_t *data)
+/* Caches the header of a macro and activates it if it has any steps */
+{
+    struct macro_header *h = &headers[voice][type];
+
+    h->length = data[0];
+    h->loop = data[1];
+    h->release = data[2];
+
+    // Patches saved before macros existed may hold anything here
+    if (h->length > MACRO_MAX_LENGTH)
+        h->length = 0;
+
+    if (h->length)
+        macro_active[voice] |= 1 << type;
+    else
+        macro_active[voice] &= ~(1 << type);
+
+    macro_values[voice][type] = neutral_values[type];
+}
+
+static void deactivate(void)
+{
+    for (uint8_t voice = 0; voice < MACRO_VOICES; voice++) {
+        macro_active[voice] = 0;
+        for (uint8_t type = 0; type < NUM_MACRO_TYPES; type++)
+            macro_values[voice][type] = neutral_values[type];
+    }
+}
+
+static void load_step(void)
+/* Copies the next macro of a load in progress to the edit buffer */
+{
+    uint8_t buffer[MACRO_SIZE];
+    uint8_t voice = load_next / NUM_MACRO_TYPES;
+    uint8_t type = load_next % NUM_MACRO_TYPES;
+    uint16_t offset = macro_offset(voice, type);
+
+    memory_read_burst(load_address + offset, buffer, MACRO_SIZE);
+    memory_write_burst(EDIT_BUFFER_START + offset, buffer, MACRO_SIZE);
+    set_header(voice, type, buffer);
+    load_next++;
+}
+
+static void load_finish(void)
+/* Completes a load in progress, before the edit buffer is used */
+{
+    while (load_next < NUM_MACROS)
+        load_step();
+}
+
+void macro_setup(void)
+{
+    uint8_t data[MACRO_HEADER_SIZE];
+
+    macro_set_rate(settings_read(MACRO_RATE));
+
+    for (uint8_t voice = 0; voice < MACRO_VOICES; voice++) {
+        for (uint8_t type = 0; type < NUM_MACRO_TYPES; type++) {
+            memory_read_burst(EDIT_BUFFER_START + macro_offset(voice, type), data, MACRO_HEADER_SIZE);
+            set_header(voice, type, data);
+        }
+    }
+}
+
+void macro_set_rate(uint8_t r)
+{
+    rate = (r == 0 || r > 99) ? MACRO_DEFAULT_RATE : r;
+}
+
+void macro_note_on(uint8_t voice)
+{
+    for (uint8_t type = 0; type < NUM_MACRO_TYPES; type++)
+        positions[voice][type] = 0;
+
+    released &= ~(1 << voice);
+
+    // Step immediately so the first value is heard from the start of the note
+    pending |= 1 << voice;
+}
+
+void macro_note_off(uint8_t voice)
+{
+    released |= 1 << voice;
+}
+
+static inline uint8_t next_position(const struct macro_header *h, uint8_t pos, bool is_released)
+{
+    uint8_t next = pos + 1;
+
+    if (!is_released && h->release < h->length && next > h->release)
+        return (h->loop <= h->release) ? h->loop : h->release;
+
+    if (next >= h->length) {
+        bool loops = h->loop < h->length && (h->release >= h->length || h->loop > h->release);
+        return loops ? h->loop : h->length - 1;
+    }
+
+    return next;
+}
+
+static inline void step_voice(uint8_t voice)
+{
+    bool is_released = released & (1 << voice);
+    uint32_t voice_start = EDIT_BUFFER_START + macro_offset(voice, 0);
+
+    for (uint8_t type = 0; type < NUM_MACRO_TYPES; type++) {
+        const struct macro_header *h = &headers[voice][type];
+        if (h->length == 0)
+            continue;
+
+        uint8_t pos = positions[voice][type];
+        macro_values[voice][type] = memory_read(voice_start + type * MACRO_SIZE + MACRO_HEADER_SIZE + pos);
+        positions[voice][type] = next_position(h, pos, is_released);
+    }
+}
+
+void macro_handler(void)
+/*
+  Triggers a frame at the macro rate, and steps the voices in the frame
+  one per call to spread out the memory reads.
+*/
+{
+    static uint16_t phase;
+
+    if (load_next < NUM_MACROS) {
+        load_step();
+        return;
+    }
+
+    phase += rate;
+    if (phase >= HANDLER_RATE) {
+        phase -= HANDLER_RATE;
+        pending = (1 << MACRO_VOICES) - 1;
+    }
+
+    if (pending == 0)
+        return;
+
+    for (uint8_t voice = 0; voice < MACRO_VOICES; voice++) {
+        if (pending & (1 << voice)) {
+            pending &= ~(1 << voice);
+            if (macro_active[voice])
+                step_voice(voice);
+            return;
+        }
+    }
+}
+
+void macro_initialize(uint32_t address)
+/* Clears the macros stored at the given address */
+{
+    for (uint8_t i = 0; i < MACRO_VOICES * NUM_MACRO_TYPES; i++)
+        memory_write(address + (uint16_t)i * MACRO_SIZE, 0);
+}
+
+static void copy(uint32_t to, uint32_t from)
+/* Copies the macro storage one macro at a time, using burst transfers */
+{
+    uint8_t buffer[MACRO_SIZE];
+
+    for (uint16_t i = 0; i < MACRO_STORAGE_SIZE; i += MACRO_SIZE) {
+        memory_read_burst(from + i, buffer, MACRO_SIZE);
+        memory_write_burst(to + i, buffer, MACRO_SIZE);
+    }
+}
+
+void macro_load(uint32_t address)
+/*
+  Starts copying the macros stored at the given address to the edit
+  buffer. This is done by the following handler calls.
+*/
+{
+    deactivate();
+    load_address = address;
+    load_next = 0;
+}
+
+void macro_save(uint32_t address)
+/* Copies the edit buffer to the given address */
+{
+    load_finish();
+    copy(address, EDIT_BUFFER_START);
+}
+
+void macro_write_header(uint8_t voice, uint8_t type, uint8_t length, uint8_t loop, uint8_t release)
+{
+    if (voice >= MACRO_VOICES || type >= NUM_MACRO_TYPES)
+        return;
+
+    if (length > MACRO_MAX_LENGTH)
+        length = MACRO_MAX_LENGTH;
+
+    load_finish();
+
+    uint32_t address = EDIT_BUFFER_START + macro_offset(voice, type);
+    memory_write(address, length);
+    memory_write(address + 1, loop);
+    memory_write(address + 2, release);
+
+    struct macro_header *h = &headers[voice][type];
+    h->length = length;
+    h->loop = loop;
+    h->release = release;
+    positions[voice][type] = 0;
+
+    if (length) {
+        macro_active[voice] |= 1 << type;
+    }
+    else {
+        macro_active[voice] &= ~(1 << type);
+        macro_values[voice][type] = neutral_values[type];
+    }
+}
+
+void macro_write_step(uint8_t voice, uint8_t type, uint8_t step, int8_t value)
+{
+    if (voice >= MACRO_VOICES || type >= NUM_MACRO_TYPES || step >= MACRO_MAX_LENGTH)
+        return;
+
+    load_finish();
+    memory_write(EDIT_BUFFER_START + macro_offset(voice, type) + MACRO_HEADER_SIZE + step, value);
+}
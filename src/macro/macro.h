@@ -0,0 +1,65 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Instrument macros
+
+  Per voice volume, duty, pitch and arpeggio sequences, stepped at a
+  fixed frame rate like the instrument macros of NES music trackers.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+
+#define MACRO_VOICES 4           // SQ1, SQ2, TRI and NOISE
+
+enum macro_type {
+    MACRO_VOLUME,                // 0 to 15, scales the envelope
+    MACRO_DUTY,                  // 0 to 3, replaces the duty parameter
+    MACRO_PITCH,                 // Offset in 1/16 semitones
+    MACRO_ARPEGGIO,              // Offset in semitones
+    NUM_MACRO_TYPES
+};
+
+#define MACRO_SIZE 24            // Length, loop, release and steps
+#define MACRO_MAX_LENGTH 21
+#define MACRO_NONE 0x7F          // No loop or release point
+
+// Size of the macros stored with each patch
+#define MACRO_STORAGE_SIZE (MACRO_VOICES * NUM_MACRO_TYPES * MACRO_SIZE)
+
+#define MACRO_DEFAULT_RATE 60    // Hz
+
+/* Current macro values, neutral for voices without the macro */
+extern int8_t macro_values[MACRO_VOICES][NUM_MACRO_TYPES];
+extern uint8_t macro_active[MACRO_VOICES];
+
+void macro_setup(void);
+void macro_set_rate(uint8_t rate);
+void macro_note_on(uint8_t voice);
+void macro_note_off(uint8_t voice);
+void macro_handler(void);
+
+void macro_initialize(uint32_t address);
+void macro_load(uint32_t address);
+void macro_save(uint32_t address);
+void macro_write_header(uint8_t voice, uint8_t type, uint8_t length, uint8_t loop, uint8_t release);
+void macro_write_step(uint8_t voice, uint8_t type, uint8_t step, int8_t value);
@@ -35,6 +35,7 @@
 #include "io/battery.h"
 #include "modulation/periods.h"
 #include "assigner/assigner.h"
+#include "macro/macro.h"
 #include "sequencer/sequencer.h"
 #include "ui/ui_sequencer.h"
 #include "ui/ui_programmer.h"
@@ -43,12 +44,21 @@
 #include "patch/patch.h"
 #include "midi/midi.h"
 #include "midi/midi_cc.h"
+#include "sample/sample.h"
+#include "integrity/integrity.h"
 
 #include <util/delay.h>
 
+// Changed whenever the memory layout changes, to force reinitialization
 #define MAGIC 0xdeadbeef
 #define MAGIC_ADDR 0
 
+// Version of the memory layout, which the first firmware didn't store.
+// A layout it can be moved from is marked with a new version instead of
+// a new magic.
+#define LAYOUT 0x4c590001
+#define LAYOUT_ADDR 0x20
+
 static bool ram_integrity_check(void)
 {
     for (uint8_t i = 0; i < 8; i++)
@@ -59,14 +69,37 @@ static bool ram_integrity_check(void)
 }
 
 static void ram_initialize(void)
+/*
+  Settings, patches and patterns are formatted in the background, or
+  when first used, so that startup isn't held up. The magic is written
+  last, so that a power-off before this is done starts over.
+*/
 {
+    integrity_reset();
+    integrity_format();
+    memory_write_dword(LAYOUT_ADDR, LAYOUT);
     for (uint8_t i = 0; i < 8; i++)
         memory_write_dword(MAGIC_ADDR+4*i, MAGIC);
         // memory_write_dword(MAGIC_ADDR+4*i, reverse_dword(MAGIC));  // load bytes to memory in correct order (will erase SRAM)
-    settings_init();
-    for (uint8_t i = 0; i < 100; i++)
-        patch_initialize(i);
-    sequencer_pattern_init();
+}
+
+static void layout_migrate(void)
+/*
+  Moves the patches and patterns saved by the first firmware to where
+  they are kept now, at the top of memory, and deletes the samples that
+  used that part. The settings it didn't have are initialized. The last two of its patterns overlap the sample index,
+  so they are moved before the index is changed. The old copies are
+  left as they are until the new layout is marked, so a migration cut
+  short by a power-off is started over. The integrity table takes the
+  old patches' place, so it is only set up afterwards.
+*/
+{
+    patch_migrate();
+    sequencer_pattern_migrate();
+    sample_release_reserved();
+    settings_migrate();
+    memory_write_dword(LAYOUT_ADDR, LAYOUT);
+    integrity_reset();
 }
 
 void startup_check(void)
@@ -79,8 +112,18 @@ void startup_check(void)
         | ((ram_good ? 0 : 1) << UI_STARTUP_ERROR_CORRUPT_RAM);
 
     if (!ram_good) {
+        // Samples stored by earlier firmware may use the reserved area
+        sample_release_reserved();
         ram_initialize();
     }
+    else if (memory_read_dword(LAYOUT_ADDR) != LAYOUT) {
+        layout_migrate();
+    }
+    else {
+        // Damage within the stored regions is found and repaired in the
+        // background from here on
+        integrity_setup();
+    }
 }
 
 int main()
@@ -98,6 +141,7 @@ int main()
     // Set up higher level:
     task_setup();
     assigner_setup();
+    macro_setup();
     periods_setup();
     sequencer_setup();
     ui_sequencer_setup();
@@ -35,17 +35,22 @@
 #include "ui/ui_programmer.h"
 #include "ui/ui_sequencer.h"
 #include "modulation/modulation.h"
+#include "modulation/modmatrix.h"
 #include "io/leds.h"
 #include "portamento/portamento.h"
 #include "assigner/assigner.h"
 #include "sequencer/sequencer.h"
 #include "patch/patch.h"
+#include "patch/morph.h"
 #include "settings/settings.h"
 #include "note_stack/note_stack.h"
 #include "midi_cc.h"
 
 enum midi_state state = STATE_MESSAGE;
 
+// Registered parameter number selected on the MPE master channel
+static uint16_t rpn = 0x3FFF;
+
 static inline void interpret_message();
 
 static inline uint8_t get_midi_channel(uint8_t channel)
@@ -53,6 +58,26 @@ static inline uint8_t get_midi_channel(uint8_t channel)
     return channel + 1;
 }
 
+static inline void mpe_configuration(uint8_t cc, uint8_t value)
+/*
+  Follows the RPN selected on the master channel, to pick up the MPE
+  Configuration Message (RPN 6) setting the number of member channels
+*/
+{
+    switch (cc) {
+    case MIDI_CC_RPN_MSB:
+        rpn = (rpn & 0x7F) | (uint16_t)value << 7;
+        break;
+    case MIDI_CC_RPN_LSB:
+        rpn = (rpn & 0x3F80) | value;
+        break;
+    case MIDI_CC_DATA_ENTRY:
+        if (rpn == MIDI_RPN_MPE)
+            assigner_mpe_configure(value);
+        break;
+    }
+}
+
 /* Apply a new message */
 void midi_channel_apply(struct midi_message* msg)
 {
@@ -65,9 +90,12 @@ void midi_channel_apply(struct midi_message* msg)
                 if (msg->data2 == 0) {
                     if (sequencer_midi_note == msg->data1)
                         sequencer_midi_note = 0xFF;
+                    sequencer_record_release(midi_channel, msg->data1, msg->time);
                     note_stack_pop(midi_channel, msg->data1);
                 } else {
                     sequencer_midi_note = msg->data1;
+                    sequencer_record_note(midi_channel, msg->data1, msg->time);
+                    assigner_notify_velocity(midi_channel, msg->data2);
                     note_stack_push(midi_channel, msg->data1);
                 }
             }
@@ -76,10 +104,27 @@ void midi_channel_apply(struct midi_message* msg)
         case MIDI_CMD_NOTE_OFF:
             if (sequencer_midi_note == msg->data1)
                 sequencer_midi_note = 0xFF;
+            sequencer_record_release(midi_channel, msg->data1, msg->time);
             note_stack_pop(midi_channel, msg->data1);
             break;
 
+        case MIDI_CMD_AFTERTOUCH:
+            assigner_notify_aftertouch(midi_channel, msg->data1, msg->data2);
+            break;
+
+        case MIDI_CMD_CHANNEL_PRESSURE:
+            assigner_notify_aftertouch(midi_channel, ASSIGNER_ALL_NOTES, msg->data1);
+            break;
+
         case MIDI_CMD_PITCH_BEND:
+            if (assigner_mpe_members && midi_channel == MPE_MASTER_CHANNEL) {
+                mod_pitchbend_master = ((uint16_t)msg->data1) | ((uint16_t)msg->data2) << 7;
+                break;
+            }
+            if (assigner_mpe_member(midi_channel)) {
+                assigner_mpe_bend(midi_channel, ((uint16_t)msg->data1) | ((uint16_t)msg->data2) << 7);
+                break;
+            }
             for (uint8_t i = 0; i < 5; i++) {
                 if (assigner_midi_channel_get(i) == midi_channel) {
                     if (i < 3)
@@ -91,6 +136,26 @@ void midi_channel_apply(struct midi_message* msg)
             break;
 
         case MIDI_CMD_CONTROL_CHANGE:
+            if (msg->data1 == MIDI_CC_MODWHEEL) {
+                for (uint8_t i = 0; i < 5; i++) {
+                    if (assigner_midi_channel_get(i) == midi_channel)
+                        mod_wheel[i] = msg->data2;
+                }
+            }
+            else if (msg->data1 == MIDI_CC_TIMBRE) {
+                uint8_t voices = assigner_mpe_voices(midi_channel);
+                for (uint8_t i = 0; i < 5; i++) {
+                    if ((voices & (1 << i)) || assigner_midi_channel_get(i) == midi_channel)
+                        mod_timbre[i] = msg->data2;
+                }
+            }
+            else if (msg->data1 == MIDI_CC_MORPH_TARGET)
+                morph_set_target(msg->data2);
+            else if (msg->data1 == MIDI_CC_MORPH)
+                morph_set_position(msg->data2);
+            else if (midi_channel == MPE_MASTER_CHANNEL)
+                mpe_configuration(msg->data1, msg->data2);
+
             control_change(midi_channel, msg->data1, msg->data2);
             break;
 
@@ -140,6 +205,7 @@ static inline void interpret_message()
                 break;
 
             case MIDI_CMD_SONGPOS:
+                sequencer_song_position(msg.data1 | (uint16_t)msg.data2 << 7);
                 break;
 
             case MIDI_CMD_SONGSEL:
@@ -3,6 +3,7 @@
 #include "midi_cc.h"
 #include "midi.h"
 #include "assigner/assigner.h"
+#include "modulation/modmatrix.h"
 
 /*
    Midi CC to parameter table
@@ -18,7 +19,7 @@ struct state_toggle triangle_state[MAX_TRIANGLE_STATES];
 struct state_toggle noise_state[MAX_NOISE_STATES];
 struct state_toggle dmc_state[MAX_DMC_STATES];
 
-size_t state_sizes[] = {
+static const uint8_t state_sizes[] PROGMEM = {
     sizeof(pulse1_state) / sizeof(pulse1_state[0]),
     sizeof(pulse2_state) / sizeof(pulse2_state[0]),
     sizeof(triangle_state) / sizeof(triangle_state[0]),
@@ -29,7 +30,7 @@ size_t state_sizes[] = {
 void state_toggle_init(struct state_toggle *arg, size_t ln)
 {
     size_t i;
-    ln = state_sizes[ln];
+    ln = pgm_read_byte_near(&state_sizes[ln]);
     for (i = 0; i < ln; i++) {
         arg[i].stashed = false;
     }
@@ -164,6 +165,35 @@ const struct midi_command global_cc[] PROGMEM = {
 
     {54, LFO3_PERIOD},
     {55, LFO3_WAVEFORM},
+
+    {56, VELOCITY_CURVE},
+    {57, AFTERTOUCH_CURVE},
+    {58, UNISON_SPREAD},
+
+    // Modulation matrix slots
+    {102, MOD1_SOURCE},
+    {103, MOD1_DEST},
+    {104, MOD1_DEPTH},
+
+    {105, MOD2_SOURCE},
+    {106, MOD2_DEST},
+    {107, MOD2_DEPTH},
+
+    {108, MOD3_SOURCE},
+    {109, MOD3_DEST},
+    {110, MOD3_DEPTH},
+
+    {111, MOD4_SOURCE},
+    {112, MOD4_DEST},
+    {113, MOD4_DEPTH},
+
+    {114, MOD5_SOURCE},
+    {115, MOD5_DEST},
+    {116, MOD5_DEPTH},
+
+    {117, MOD6_SOURCE},
+    {118, MOD6_DEST},
+    {119, MOD6_DEPTH},
 };
 
 const uint8_t midi_channels_cc_lengths[] PROGMEM = {
@@ -293,11 +323,15 @@ void control_change(uint8_t midi_chn, uint8_t data1, uint8_t data2)
 {
     uint8_t chn = assigner_channel_get(midi_chn);
 
-    // Allow LFO updates on any channel
-    if (data1 > 49 && data1 < 56) {
+    // Allow LFO, curve, unison and modulation matrix updates on any channel
+    if ((data1 > 49 && data1 < 59) || (data1 > 101 && data1 < 120)) {
         chn = 5;
     }
 
+    // Channels not listened to, such as MPE member channels
+    if (chn > 5)
+        return;
+
     // This will be moved into the new objects
     if (chn < 5 && data1 == 121 && data2 > 63) {
         return midi_channels_cc_reset(chn);
@@ -340,4 +374,7 @@ void control_change(uint8_t midi_chn, uint8_t data1, uint8_t data2)
     }
 
     *parameter.target = target_value;
+
+    if (chn == 5)
+        mod_matrix_compile();
 }
\ No newline at end of file
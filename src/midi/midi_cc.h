@@ -7,6 +7,14 @@
 
 #define MIDI_MAX_CC 0x80 //128
 #define MIDI_MID_CC 0x3F //63
+#define MIDI_CC_MODWHEEL 1
+#define MIDI_CC_DATA_ENTRY 6
+#define MIDI_CC_TIMBRE 74
+#define MIDI_CC_MORPH_TARGET 89
+#define MIDI_CC_MORPH 90
+#define MIDI_CC_RPN_LSB 100
+#define MIDI_CC_RPN_MSB 101
+#define MIDI_RPN_MPE 0x0006
 // #define NULL ((void *) 0)
 
 struct midi_command {
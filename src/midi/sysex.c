@@ -33,6 +33,8 @@
 #include "patch/patch.h"
 #include "sample/sample.h"
 #include "settings/settings.h"
+#include "modulation/periods.h"
+#include "macro/macro.h"
 #include "ui/ui.h"
 #include "ui/ui_programmer.h"
 
@@ -55,7 +57,8 @@ struct sysex_header syx_header = {
     .sample_number = MIDI_STATUS_UNDEF,
     .sample_type = MIDI_STATUS_UNDEF,
     .sample_size = 0,
-    .sample_size_bytes = 0
+    .sample_size_bytes = 0,
+    .data_count = 0
 };
 
 void reset_sysex_header(struct sysex_header *hdr)
@@ -69,6 +72,7 @@ void reset_sysex_header(struct sysex_header *hdr)
     hdr->sample_type = MIDI_STATUS_UNDEF;
     hdr->sample_size = 0;
     hdr->sample_size_bytes = 0;
+    hdr->data_count = 0;
 }
 
 uint8_t valid_header_byte(uint8_t hdr_byte)
@@ -84,6 +88,10 @@ uint8_t sysex_stop_byte(uint8_t syx)
     if (syx != SYSEX_STOP) {
         return 0;
     } else {
+        // A tuning message may be cut short after the A4 reference, so the
+        // period table is rebuilt when the message ends
+        if (syx_header.command == SYSEX_CMD_TUNING_LOAD && syx_header.data_count >= 2)
+            periods_setup();
         reset_sysex_header(&syx_header);
         return 1;
     }
@@ -167,6 +175,69 @@ void sysex()
                 ignore_sysex();  // ignore any extra bytes
             }
 
+            else if (syx_header.command == SYSEX_CMD_TUNING_LOAD) {
+                /*
+                    example message (A4 = 432.0 Hz, 12-TET):
+                    F0    7D    4E    05    60    21    40 .. 40    F7
+                    STRT  {  ID  }    CMD   { A4 }      { MAP }     END
+
+                    A4 is given in 1/10 Hz as two 7-bit bytes, LSB first.
+                    The optional map holds 12 deviations from equal
+                    temperament, one per scale degree starting at C, in
+                    cents offset by 64 (like the MIDI scale/octave tuning).
+                */
+                static uint8_t a4_low;
+
+                uint8_t n = syx_header.data_count++;
+                if (n == 0)
+                    a4_low = val;
+                else if (n == 1) {
+                    uint16_t a4 = a4_low | (uint16_t)val << 7;
+                    settings_write(TUNING_A4_LOW, a4 & 0xFF);
+                    settings_write(TUNING_A4_HIGH, a4 >> 8);
+                }
+                else if (n < 2 + TUNING_MAP_SIZE)
+                    settings_write(TUNING_MAP + n - 2, (int8_t)val - 64);
+
+                if (syx_header.data_count == 2 + TUNING_MAP_SIZE)
+                    ignore_sysex();  // ignore any extra bytes
+            }
+
+            else if (syx_header.command == SYSEX_CMD_MACRO_LOAD) {
+                /*
+                    example message (SQ1 duty macro 2 1 0, looping):
+                    F0    7D    4E    06    00    01    03    00    7F    42 41 40    F7
+                    STRT  {  ID  }    CMD   VCE   TYPE  LEN   LOOP  REL   {STEPS}     END
+
+                    The macro is written to the current sound and is stored
+                    when the patch is saved. Loop and release points of 7F
+                    mean none. Steps are offset by 64.
+                */
+                static uint8_t voice, type, length, loop;
+
+                uint8_t n = syx_header.data_count++;
+                if (n == 0)
+                    voice = val;
+                else if (n == 1)
+                    type = val;
+                else if (n == 2)
+                    length = val;
+                else if (n == 3)
+                    loop = val;
+                else if (n == 4) {
+                    if (voice >= MACRO_VOICES || type >= NUM_MACRO_TYPES || length > MACRO_MAX_LENGTH) {
+                        ignore_sysex();
+                        return;
+                    }
+                    macro_write_header(voice, type, length, loop, val);
+                }
+                else
+                    macro_write_step(voice, type, n - 5, (int8_t)val - 64);
+
+                if (n >= 4 && syx_header.data_count == 5 + length)
+                    ignore_sysex();  // ignore any extra bytes
+            }
+
             else {
                 ignore_sysex();
             }
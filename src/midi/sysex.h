@@ -40,6 +40,8 @@ enum sysex_cmd {
     SYSEX_CMD_SETTINGS_LOAD,
     SYSEX_CMD_PATCH_LOAD,
     SYSEX_CMD_SEQUENCE_LOAD,
+    SYSEX_CMD_TUNING_LOAD,
+    SYSEX_CMD_MACRO_LOAD,
 };
 
 enum sysex_data_format {
@@ -57,6 +59,7 @@ struct sysex_header {
     uint32_t sample_size;
     uint8_t sample_size_bytes;
 
+    uint8_t data_count;
     uint8_t data_ready;
 };
 
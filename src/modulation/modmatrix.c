@@ -0,0 +1,199 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Modulation matrix
+
+  A number of patch programmable slots, each routing a modulation source
+  to a destination with a given depth.
+
+  The slots are compiled into a list of active routings whenever they are
+  changed. Each routing refers to an entry in a flat table of source
+  values, so evaluating the matrix is a single loop over the active
+  routings doing one multiply-add each. Per channel sources (velocity,
+  aftertouch, mod wheel, note) are resolved to the channel of the
+  destination when compiling.
+*/
+
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "modulation/modmatrix.h"
+#include "apu/apu.h"
+#include "lfo/lfo.h"
+#include "envelope/envelope.h"
+#include "assigner/assigner.h"
+
+/* Patch programmable parameters */
+struct mod_slot mod_matrix[MOD_MATRIX_SLOTS];
+int8_t mod_velocity_curve;
+int8_t mod_aftertouch_curve;
+
+/* Input from MIDI */
+uint8_t mod_velocity[5];
+uint8_t mod_aftertouch[5];
+uint8_t mod_wheel[5];
+uint8_t mod_timbre[5];
+
+int16_t mod_matrix_out[NUM_MOD_DESTINATIONS];
+
+/*
+  Response curves for velocity and aftertouch, indexed by the input value.
+  The soft curve is a square root and the hard curve a square, both scaled
+  to 0-127.
+*/
+const uint8_t mod_curves[2][128] PROGMEM = {
+    {
+          0,  11,  16,  20,  23,  25,  28,  30,  32,  34,  36,  37,  39,  41,  42,  44,
+         45,  46,  48,  49,  50,  52,  53,  54,  55,  56,  57,  59,  60,  61,  62,  63,
+         64,  65,  66,  67,  68,  69,  69,  70,  71,  72,  73,  74,  75,  76,  76,  77,
+         78,  79,  80,  80,  81,  82,  83,  84,  84,  85,  86,  87,  87,  88,  89,  89,
+         90,  91,  92,  92,  93,  94,  94,  95,  96,  96,  97,  98,  98,  99, 100, 100,
+        101, 101, 102, 103, 103, 104, 105, 105, 106, 106, 107, 108, 108, 109, 109, 110,
+        110, 111, 112, 112, 113, 113, 114, 114, 115, 115, 116, 117, 117, 118, 118, 119,
+        119, 120, 120, 121, 121, 122, 122, 123, 123, 124, 124, 125, 125, 126, 126, 127
+    },
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   2,   2,
+          2,   2,   3,   3,   3,   3,   4,   4,   5,   5,   5,   6,   6,   7,   7,   8,
+          8,   9,   9,  10,  10,  11,  11,  12,  13,  13,  14,  15,  15,  16,  17,  17,
+         18,  19,  20,  20,  21,  22,  23,  24,  25,  26,  26,  27,  28,  29,  30,  31,
+         32,  33,  34,  35,  36,  37,  39,  40,  41,  42,  43,  44,  45,  47,  48,  49,
+         50,  52,  53,  54,  56,  57,  58,  60,  61,  62,  64,  65,  67,  68,  70,  71,
+         73,  74,  76,  77,  79,  80,  82,  84,  85,  87,  88,  90,  92,  94,  95,  97,
+         99, 101, 102, 104, 106, 108, 110, 112, 113, 115, 117, 119, 121, 123, 125, 127
+    }
+};
+
+/*
+  Layout of the source value table. The first six entries are shared by
+  all channels, the rest have one entry per channel.
+*/
+#define VALUE_LFO 0
+#define VALUE_ENV 3
+#define VALUE_VELOCITY 6
+#define VALUE_AFTERTOUCH (VALUE_VELOCITY + 5)
+#define VALUE_MODWHEEL (VALUE_AFTERTOUCH + 5)
+#define VALUE_NOTE (VALUE_MODWHEEL + 5)
+#define VALUE_TIMBRE (VALUE_NOTE + 5)
+#define NUM_VALUES (VALUE_TIMBRE + 5)
+
+static const uint8_t source_values[NUM_MOD_SOURCES] PROGMEM = {
+    [MOD_SRC_LFO1] = VALUE_LFO,
+    [MOD_SRC_LFO2] = VALUE_LFO + 1,
+    [MOD_SRC_LFO3] = VALUE_LFO + 2,
+    [MOD_SRC_ENV1] = VALUE_ENV,
+    [MOD_SRC_ENV2] = VALUE_ENV + 1,
+    [MOD_SRC_ENV3] = VALUE_ENV + 2,
+    [MOD_SRC_VELOCITY] = VALUE_VELOCITY,
+    [MOD_SRC_AFTERTOUCH] = VALUE_AFTERTOUCH,
+    [MOD_SRC_MODWHEEL] = VALUE_MODWHEEL,
+    [MOD_SRC_NOTE] = VALUE_NOTE,
+    [MOD_SRC_TIMBRE] = VALUE_TIMBRE
+};
+
+static const uint8_t destination_channels[NUM_MOD_DESTINATIONS] PROGMEM = {
+    [MOD_DST_SQ1_PITCH] = CHN_SQ1,
+    [MOD_DST_SQ2_PITCH] = CHN_SQ2,
+    [MOD_DST_TRI_PITCH] = CHN_TRI,
+    [MOD_DST_NOISE_PERIOD] = CHN_NOISE,
+    [MOD_DST_SQ1_VOLUME] = CHN_SQ1,
+    [MOD_DST_SQ2_VOLUME] = CHN_SQ2,
+    [MOD_DST_NOISE_VOLUME] = CHN_NOISE,
+    [MOD_DST_SQ1_DUTY] = CHN_SQ1,
+    [MOD_DST_SQ2_DUTY] = CHN_SQ2,
+    [MOD_DST_DMC_RATE] = CHN_DMC
+};
+
+struct routing {
+    uint8_t value;
+    uint8_t destination;
+    int8_t depth;
+    /* Volume is modulated downwards from the current level, so the
+       maximum source value is subtracted for volume destinations */
+    int8_t bias;
+};
+
+static struct routing routings[MOD_MATRIX_SLOTS];
+static uint8_t num_routings;
+
+static inline uint8_t is_volume(uint8_t destination)
+{
+    return destination >= MOD_DST_SQ1_VOLUME && destination <= MOD_DST_NOISE_VOLUME;
+}
+
+void mod_matrix_compile(void)
+/*
+  Rebuilds the list of active routings. Must be called whenever a slot
+  has been changed.
+*/
+{
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < MOD_MATRIX_SLOTS; i++) {
+        const struct mod_slot *slot = &mod_matrix[i];
+
+        if (slot->source <= MOD_SRC_OFF || slot->source >= NUM_MOD_SOURCES
+            || slot->destination <= MOD_DST_OFF || slot->destination >= NUM_MOD_DESTINATIONS
+            || slot->depth == 0)
+            continue;
+
+        uint8_t value = pgm_read_byte_near(&source_values[slot->source]);
+        if (value >= VALUE_VELOCITY)
+            value += pgm_read_byte_near(&destination_channels[slot->destination]);
+
+        routings[n].value = value;
+        routings[n].destination = slot->destination;
+        routings[n].depth = slot->depth;
+        routings[n].bias = is_volume(slot->destination) ? 127 : 0;
+        n++;
+    }
+
+    num_routings = n;
+}
+
+void mod_matrix_evaluate(void)
+{
+    for (uint8_t i = 0; i < NUM_MOD_DESTINATIONS; i++)
+        mod_matrix_out[i] = 0;
+
+    if (num_routings == 0)
+        return;
+
+    // Gathered on the stack, as it is only needed during the evaluation
+    int8_t values[NUM_VALUES];
+
+    for (uint8_t i = 0; i < 3; i++) {
+        values[VALUE_LFO + i] = lfo[i].value;
+        values[VALUE_ENV + i] = env[i].value * 8;
+    }
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        values[VALUE_VELOCITY + chn] = mod_velocity[chn];
+        values[VALUE_AFTERTOUCH + chn] = mod_aftertouch[chn];
+        values[VALUE_MODWHEEL + chn] = mod_wheel[chn];
+        values[VALUE_NOTE + chn] = assigned_notes[chn] - 60;
+        values[VALUE_TIMBRE + chn] = mod_timbre[chn];
+    }
+
+    for (uint8_t i = 0; i < num_routings; i++) {
+        const struct routing *r = &routings[i];
+        mod_matrix_out[r->destination] += ((int16_t)r->depth * (values[r->value] - r->bias)) >> 4;
+    }
+}
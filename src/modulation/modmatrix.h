@@ -0,0 +1,111 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+  Modulation matrix
+
+  A number of patch programmable slots, each routing a modulation source
+  to a destination with a given depth.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define MOD_MATRIX_SLOTS 6
+
+enum mod_source {
+    MOD_SRC_OFF,
+    MOD_SRC_LFO1,
+    MOD_SRC_LFO2,
+    MOD_SRC_LFO3,
+    MOD_SRC_ENV1,
+    MOD_SRC_ENV2,
+    MOD_SRC_ENV3,
+    MOD_SRC_VELOCITY,
+    MOD_SRC_AFTERTOUCH,
+    MOD_SRC_MODWHEEL,
+    MOD_SRC_NOTE,
+    MOD_SRC_TIMBRE,
+    NUM_MOD_SOURCES
+};
+
+enum mod_destination {
+    MOD_DST_OFF,
+    MOD_DST_SQ1_PITCH,
+    MOD_DST_SQ2_PITCH,
+    MOD_DST_TRI_PITCH,
+    MOD_DST_NOISE_PERIOD,
+    MOD_DST_SQ1_VOLUME,
+    MOD_DST_SQ2_VOLUME,
+    MOD_DST_NOISE_VOLUME,
+    MOD_DST_SQ1_DUTY,
+    MOD_DST_SQ2_DUTY,
+    MOD_DST_DMC_RATE,
+    NUM_MOD_DESTINATIONS
+};
+
+enum mod_curve {
+    MOD_CURVE_LINEAR,
+    MOD_CURVE_SOFT,
+    MOD_CURVE_HARD,
+    MOD_CURVE_FIXED,
+    NUM_MOD_CURVES
+};
+
+struct mod_slot {
+    int8_t source;
+    int8_t destination;
+    int8_t depth;
+};
+
+/* Patch programmable parameters */
+extern struct mod_slot mod_matrix[MOD_MATRIX_SLOTS];
+extern int8_t mod_velocity_curve;
+extern int8_t mod_aftertouch_curve;
+
+/* Per channel input from MIDI */
+extern uint8_t mod_velocity[5];
+extern uint8_t mod_aftertouch[5];
+extern uint8_t mod_wheel[5];
+extern uint8_t mod_timbre[5];
+
+/* Sum of all slots for each destination */
+extern int16_t mod_matrix_out[NUM_MOD_DESTINATIONS];
+
+extern const uint8_t mod_curves[2][128] PROGMEM;
+
+static inline uint8_t mod_curve_apply(int8_t curve, uint8_t value)
+/* Shapes a 0-127 MIDI value by one of the response curves */
+{
+    switch (curve) {
+    case MOD_CURVE_SOFT:
+    case MOD_CURVE_HARD:
+        return pgm_read_byte_near(&mod_curves[curve - MOD_CURVE_SOFT][value & 0x7F]);
+    case MOD_CURVE_FIXED:
+        return 127;
+    default:
+        return value;
+    }
+}
+
+void mod_matrix_compile(void);
+void mod_matrix_evaluate(void);
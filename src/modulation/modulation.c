@@ -29,10 +29,13 @@
 #include <avr/pgmspace.h>
 #include "periods.h"
 #include "modulation/modulation.h"
+#include "modulation/modmatrix.h"
+#include "macro/macro.h"
 #include "apu/apu.h"
 #include "lfo/lfo.h"
 #include "envelope/envelope.h"
 #include "portamento/portamento.h"
+#include "assigner/assigner.h"
 
 #define ABS(x) ((x > 0) ? (x) : (-x))
 
@@ -41,18 +44,33 @@ int8_t mod_lfo_modmatrix[4][3];
 int8_t mod_lfo_vol[3];
 int8_t mod_detune[3];
 int8_t mod_envmod[4];
-int8_t mod_pitchbend[3];
+int8_t mod_pitchbend[4];        // The noise channel's is kept with the patch, but not applied
 int8_t mod_octave[3];
+int8_t mod_unison_spread;
 
 /* Input from MIDI  */
 uint16_t mod_pitchbend_input[4] = {0x2000, 0x2000, 0x2000, 0x2000};
+uint16_t mod_pitchbend_master = 0x2000;   // MPE master channel bend
 uint8_t noise_period;
 
+/* Set by sequencer volume locks, 15 is full volume */
+uint8_t mod_step_volume[4] = {15, 15, 15, 15};
+
+/* Set by the assigner for stacked voices in unison mode */
+int8_t mod_unison_position[3];   // -64 to 64, position in the detune spread
+uint8_t mod_sq2_env = 1;         // Envelope used by SQ2, 0 when following SQ1
+
 static int16_t dc_temp[3];
 
 static inline int16_t get_pitchbend(uint8_t chn)
 {
-    return (int16_t)((mod_pitchbend_input[chn] >> 7) - 0x40) * mod_pitchbend[chn];
+    if (!assigner_mpe_members)
+        return (int16_t)((mod_pitchbend_input[chn] >> 7) - 0x40) * mod_pitchbend[chn];
+
+    // In MPE mode the per note bend has the standard range of 48 semitones,
+    // and the master channel bend uses the patch's range on top of it
+    int16_t note_bend = ((int32_t)mod_pitchbend_input[chn] - 0x2000) * 3 >> 3;
+    return note_bend + (int16_t)((mod_pitchbend_master >> 7) - 0x40) * mod_pitchbend[chn];
 }
 
 static inline int16_t get_coarse_tune(uint8_t chn)
@@ -92,8 +110,12 @@ static inline void apply_freqmod(uint8_t chn)
     case CHN_TRI:
         tri.period = period;
         break;
-    case CHN_NOISE:
-        noise.period = noise_period;
+    case CHN_NOISE: {
+        int8_t p = noise_period + (mod_matrix_out[MOD_DST_NOISE_PERIOD] >> 6)
+            + macro_values[CHN_NOISE][MACRO_ARPEGGIO];
+        noise.period = (p < 0) ? 0 : (p > 15) ? 15 : p;
+        break;
+    }
     }
 }
 
@@ -121,7 +143,19 @@ static inline void calc_freqmod(uint8_t chn)
         dc += mod_detune[chn];
 
         // Add envelope modulation, if set
-        dc += (int16_t)4 * mod_envmod[chn] * env[chn].value;
+        uint8_t env_index = (chn == CHN_SQ2) ? mod_sq2_env : chn;
+        dc += (int16_t)4 * mod_envmod[chn] * env[env_index].value;
+
+        // Spread stacked voices, up to half a semitone either way
+        if (mod_unison_position[chn])
+            dc += ((int16_t)mod_unison_spread * mod_unison_position[chn]) / 198;
+
+        // Add modulation matrix pitch modulation
+        dc += mod_matrix_out[MOD_DST_SQ1_PITCH + chn] >> 1;
+
+        // Add pitch and arpeggio macros
+        dc += (int16_t)4 * macro_values[chn][MACRO_PITCH];
+        dc += (int16_t)macro_values[chn][MACRO_ARPEGGIO] << 6;
 
         // Store total dc value, which will be applied by apply_freqmod
         dc_temp[chn] = dc;
@@ -131,12 +165,79 @@ static inline void calc_freqmod(uint8_t chn)
     }
 }
 
+static inline uint8_t matrix_volume(uint8_t volume, uint8_t dst)
+/*
+  Scales a volume by the modulation matrix output for the given
+  destination. The output is a gain in 1/16ths centered on 16.
+*/
+{
+    if (mod_matrix_out[dst] == 0)
+        return volume;
+
+    int16_t gain = 16 + (((int32_t)mod_matrix_out[dst] * 21) >> 10);
+    if (gain < 0)
+        gain = 0;
+    else if (gain > 32)
+        gain = 32;
+
+    uint8_t v = (volume * gain) >> 4;
+    return (v > 15) ? 15 : v;
+}
+
+static inline int8_t matrix_duty(uint8_t dst)
+{
+    return mod_matrix_out[dst] >> 8;
+}
+
+static inline uint8_t macro_volume(uint8_t volume, uint8_t chn)
+{
+    if (!(macro_active[chn] & (1 << MACRO_VOLUME)))
+        return volume;
+
+    int8_t m = macro_values[chn][MACRO_VOLUME];
+    if (m <= 0)
+        return 0;
+    if (m >= 15)
+        return volume;
+    return (volume * m) / 15;
+}
+
+static inline uint8_t step_volume(uint8_t volume, uint8_t chn)
+{
+    if (mod_step_volume[chn] >= 15)
+        return volume;
+    return (volume * mod_step_volume[chn]) / 15;
+}
+
+static inline int8_t macro_duty(const struct square *sq, uint8_t chn)
+/* Returns the duty macro as an offset from the duty parameter */
+{
+    if (!(macro_active[chn] & (1 << MACRO_DUTY)))
+        return 0;
+
+    return macro_values[chn][MACRO_DUTY] - sq->duty;
+}
+
+static inline void apply_matrixmod(void)
+/* Applies the macros, step locks and the modulation matrix to volume, duty and DMC rate */
+{
+    sq1.volume = matrix_volume(step_volume(macro_volume(sq1.volume, CHN_SQ1), CHN_SQ1), MOD_DST_SQ1_VOLUME);
+    sq2.volume = matrix_volume(step_volume(macro_volume(sq2.volume, CHN_SQ2), CHN_SQ2), MOD_DST_SQ2_VOLUME);
+    noise.volume = matrix_volume(step_volume(macro_volume(noise.volume, CHN_NOISE), CHN_NOISE), MOD_DST_NOISE_VOLUME);
+
+    sq1.duty_mod = macro_duty(&sq1, CHN_SQ1) + matrix_duty(MOD_DST_SQ1_DUTY);
+    sq2.duty_mod = macro_duty(&sq2, CHN_SQ2) + matrix_duty(MOD_DST_SQ2_DUTY);
+
+    int16_t rate = DMC_RATE_NORMAL + (mod_matrix_out[MOD_DST_DMC_RATE] >> 4);
+    dmc.rate = (rate < 16) ? 16 : (rate > 127) ? 127 : rate;
+}
+
 static inline void apply_volmod(void)
 {
     sq1.volume = !mod_lfo_vol[0] ? env[0].value
         : (env[0].value * (8 + ((int16_t)lfo[0].value * mod_lfo_vol[0])/256))/16;
-    sq2.volume = !mod_lfo_vol[1] ? env[1].value
-        : env[1].value * (8 + ((int16_t)lfo[1].value * mod_lfo_vol[1])/256)/16;
+    sq2.volume = !mod_lfo_vol[1] ? env[mod_sq2_env].value
+        : env[mod_sq2_env].value * (8 + ((int16_t)lfo[1].value * mod_lfo_vol[1])/256)/16;
     noise.volume = !mod_lfo_vol[2] ? env[2].value
         : env[2].value * (8 + ((int16_t)lfo[2].value * mod_lfo_vol[2])/256)/16;
 }
@@ -144,6 +245,8 @@ static inline void apply_volmod(void)
 void mod_calculate(void)
 {
     static uint8_t chn = 0;
+    if (chn == 0)
+        mod_matrix_evaluate();
     calc_freqmod(chn);
     if (++chn == 4) chn = 0;
 }
@@ -155,4 +258,5 @@ void mod_apply(void)
     if (++chn == 4) chn = 0;
 
     apply_volmod();
+    apply_matrixmod();
 }
@@ -32,10 +32,15 @@ extern int8_t mod_lfo_vol[3];
 extern int8_t mod_detune[3];
 extern int8_t mod_envmod[4];
 extern uint16_t mod_pitchbend_input[4];
-extern int8_t mod_pitchbend[3];
+extern uint16_t mod_pitchbend_master;
+extern int8_t mod_pitchbend[4];
 extern uint8_t noise_period;
 extern int8_t mod_octave[3];
 extern int8_t mod_pwm;
+extern int8_t mod_unison_spread;
+extern int8_t mod_unison_position[3];
+extern uint8_t mod_sq2_env;
+extern uint8_t mod_step_volume[4];
 
 void mod_calculate(void);
 void mod_apply(void);
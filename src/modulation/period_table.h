@@ -1,30 +0,0 @@
-const uint16_t period_table12[84] PROGMEM = {
-  3186, 3007, 2838, 2679, 2528, 2386, 2253, 2126, 2007, 1894, 1788, 1687, 
-  1593, 1503, 1419, 1339, 1264, 1193, 1126, 1063, 1003, 947, 894, 844, 
-  796, 752, 709, 670, 632, 597, 563, 532, 502, 474, 447, 422, 
-  398, 376, 355, 335, 316, 298, 282, 266, 251, 237, 223, 211, 
-  199, 188, 177, 167, 158, 149, 141, 133, 125, 118, 112, 105, 
-  100, 94, 89, 84, 79, 75, 70, 66, 63, 59, 56, 53, 
-  50, 47, 44, 42, 40, 37, 35, 33, 31, 30, 28, 26
-};
-
-const uint16_t period_table15[84] PROGMEM = {
-  2548, 2405, 2270, 2143, 2023, 1909, 1802, 1701, 1605, 1515, 1430, 1350, 
-  1274, 1203, 1135, 1071, 1011, 955, 901, 850, 803, 758, 715, 675, 
-  637, 601, 568, 536, 506, 477, 451, 425, 401, 379, 358, 337, 
-  319, 301, 284, 268, 253, 239, 225, 213, 201, 189, 179, 169, 
-  159, 150, 142, 134, 126, 119, 113, 106, 100, 95, 89, 84, 
-  80, 75, 71, 67, 63, 60, 56, 53, 50, 47, 45, 42, 
-  40, 38, 35, 33, 32, 30, 28, 27, 25, 24, 22, 21
-};
-
-const uint16_t period_table16[84] PROGMEM = {
-  2389, 2255, 2128, 2009, 1896, 1790, 1689, 1595, 1505, 1421, 1341, 1266, 
-  1195, 1128, 1064, 1005, 948, 895, 845, 797, 753, 710, 670, 633, 
-  597, 564, 532, 502, 474, 447, 422, 399, 376, 355, 335, 316, 
-  299, 282, 266, 251, 237, 224, 211, 199, 188, 178, 168, 158, 
-  149, 141, 133, 126, 119, 112, 106, 100, 94, 89, 84, 79, 
-  75, 70, 67, 63, 59, 56, 53, 50, 47, 44, 42, 40, 
-  37, 35, 33, 31, 30, 28, 26, 25, 24, 22, 21, 20
-};
-
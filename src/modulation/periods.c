@@ -20,9 +20,10 @@
 
   Period tables
 
-  Contains tables of periods to apply to a channel to get a desired
-  note frequency. There are three different tables adjusted for each
-  of the three supported 2A03 chips.
+  Contains the table of periods to apply to a channel to get a desired
+  note frequency. The table is generated at startup (and whenever a new
+  tuning is received) from the detected 2A03 clock divider, the A4
+  reference frequency and the tuning map stored in the settings.
 */
 
 
@@ -30,9 +31,24 @@
 #include <avr/pgmspace.h>
 #include "modulation/periods.h"
 #include "io/2a03.h"
-#include "modulation/period_table.h"
+#include "settings/settings.h"
 
-const uint16_t *period_table;
+#define NUM_PERIODS 84
+
+// A4 reference in 1/10 Hz used when none is set, and the accepted range
+#define DEFAULT_A4 4400
+#define MIN_A4 4000
+#define MAX_A4 4800
+
+// Tuning map deviations in cents, as given by the tuning SysEx message
+#define MIN_DEVIATION -64
+#define MAX_DEVIATION 63
+
+// Largest table entry. The square timer is limited to 11 bits by
+// get_period, but the triangle's timer value is half the table entry.
+#define MAX_PERIOD 4096
+
+static uint16_t period_table[NUM_PERIODS];
 
 uint8_t note_min;
 const uint8_t note_max = 72;
@@ -62,12 +78,16 @@ uint16_t get_period(uint8_t chn, uint16_t c)
   uint16_t val;
   uint8_t tri_scale = 0;
   uint16_t base_period;
+
+  // Notes above the table are played at its top
+  if (tone.semitone >= NUM_PERIODS)
+    tone.semitone = NUM_PERIODS - 1;
   
   if (chn == 2 && tone.semitone < 12) {
-    base_period = pgm_read_word_near(&period_table[tone.semitone + 12]);
+    base_period = period_table[tone.semitone + 12];
   }
   else {
-    base_period = pgm_read_word_near(&period_table[tone.semitone]);
+    base_period = period_table[tone.semitone];
     if (chn == 2)
       tri_scale = 1;
   }
@@ -88,17 +108,55 @@ uint16_t get_period(uint8_t chn, uint16_t c)
     return val;
 }
 
+static float cents_to_ratio(int8_t cents)
+/*
+  Computes 2^(cents/1200) using a short power series, which is more than
+  precise enough for the -64..63 cent range of the tuning map.
+*/
+{
+  float x = cents * 0.000577622650f;   // ln(2) / 1200
+
+  return 1.0f + x * (1.0f + x * (0.5f + x * 0.16666667f));
+}
+
+uint16_t periods_a4(void)
+{
+  uint16_t a4 = (uint8_t)settings_read(TUNING_A4_LOW)
+    | (uint16_t)(uint8_t)settings_read(TUNING_A4_HIGH) << 8;
+
+  // 0 and references out of range give 440 Hz
+  if (a4 < MIN_A4 || a4 > MAX_A4)
+    return DEFAULT_A4;
+  return a4;
+}
+
 void periods_setup(void)
+/*
+  Builds the period table. The 12 periods of the lowest octave are computed
+  from the A4 reference and tuning map, and the octaves above are found by
+  halving.
+
+  The table holds T + 1, where T is the timer value of the square channels.
+*/
 {
-  switch (io_clockdiv) {
-  case 12:
-    period_table = period_table12;
-    break;
-  case 15:
-    period_table = period_table15;
-    break;
-  case 16:
-    period_table = period_table16;
-    break;
+  // 2A03 CPU clock in Hz. Fall back to the NTSC divider if no chip was found.
+  float cpu_clock = (float)F_CPU / (io_clockdiv != 0 ? io_clockdiv : 12);
+
+  // Frequency of C1 (the first table entry) given the A4 reference
+  float freq = periods_a4() * 0.1f * 0.0743254447f;  // 2^(-45/12)
+
+  for (uint8_t degree = 0; degree < 12; degree++) {
+    int8_t deviation = settings_read(TUNING_MAP + degree);
+    if (deviation < MIN_DEVIATION || deviation > MAX_DEVIATION)
+      deviation = 0;
+
+    float period = cpu_clock / (16.0f * freq * cents_to_ratio(deviation));
+
+    for (uint8_t octave = 0; octave < NUM_PERIODS / 12; octave++) {
+      period_table[12 * octave + degree] = (period < MAX_PERIOD) ? (uint16_t)(period + 0.5f) : MAX_PERIOD;
+      period *= 0.5f;
+    }
+
+    freq *= 1.0594630944f;  // 2^(1/12)
   }
 }
@@ -20,9 +20,9 @@
 
   Period tables
 
-  Contains tables of periods to apply to a channel to get a desired
-  note frequency. There are three different tables adjusted for each
-  of the three supported 2A03 chips.
+  Contains the table of periods to apply to a channel to get a desired
+  note frequency. The table is generated for the detected 2A03 chip,
+  the A4 reference frequency and the tuning map in the settings.
 */
 
 
@@ -33,4 +33,5 @@ extern uint8_t note_min;
 extern const uint8_t note_max;
 
 uint16_t get_period(uint8_t chn, uint16_t c);
+uint16_t periods_a4(void);
 void periods_setup(void);
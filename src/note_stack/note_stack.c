@@ -20,93 +20,204 @@
 
   Note Stack
 
-  Buffers held notes in monophonic mode, to improve live performace experience.
-  This behavior is called "legato" mode in most synths.
-  In polyphonic mode, reverts to previous behavior.
+  Keeps track of the held notes on each MIDI channel, in the order they
+  were played. The assigner uses this to return to held notes when a
+  note is released, both in monophonic mode (last note priority) and in
+  polyphonic mode (giving freed channels to notes that lost theirs).
+
+  The held notes of each channel form a circular doubly linked list of
+  entries from a shared pool, linked by index, so the newest note also
+  leads to the oldest. Linking and unlinking are constant time, and
+  nothing is shifted around. Notes are found through a small hash index
+  on the channel and note, so a note off doesn't walk the held notes.
 */
 
 #include <stdint.h>
-#include "apu/apu.h"
+#include "note_stack/note_stack.h"
 #include "assigner/assigner.h"
 
-#define MAX_POLY 8
+#define POOL_SIZE 16
+#define NUM_CHANNELS 16
 
-static int active_notes[16] = { 0 };  // keep track of notes held in each midi channel
-static uint8_t note_buffer[16][MAX_POLY];
+// With the pool full, a bucket holds two entries on average
+#define NUM_BUCKETS 8
 
-void clear_note_buffer()
+struct entry {
+    uint8_t note;
+    uint8_t channel;
+    uint8_t prev;    // Older note, the newest for the oldest
+    uint8_t next;    // Newer note, the oldest for the newest; next free entry when unused
+    uint8_t chain;   // Next entry in the same bucket
+};
+
+static struct entry pool[POOL_SIZE];
+static uint8_t free_list = NOTE_STACK_END;
+
+static uint8_t newest[NUM_CHANNELS];
+static uint8_t buckets[NUM_BUCKETS];
+
+static uint8_t initialized;
+
+void note_stack_clear(void)
 {
-    for (int c = 0; c < 16; ++c) {
-        active_notes[c] = 0;
-        for (int n = 0; n < MAX_POLY; ++n) {
-            note_buffer[c][n] = 255;
-        }
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++)
+        newest[i] = NOTE_STACK_END;
+
+    for (uint8_t i = 0; i < NUM_BUCKETS; i++)
+        buckets[i] = NOTE_STACK_END;
+
+    for (uint8_t i = 0; i < POOL_SIZE; i++)
+        pool[i].next = (i + 1 < POOL_SIZE) ? i + 1 : NOTE_STACK_END;
+    free_list = 0;
+
+    initialized = 1;
+}
+
+static inline uint8_t *bucket(uint8_t c, uint8_t note)
+{
+    // The notes of a chord differ in their lowest bits
+    return &buckets[(note ^ c) % NUM_BUCKETS];
+}
+
+static inline uint8_t find(uint8_t c, uint8_t note)
+{
+    for (uint8_t i = *bucket(c, note); i != NOTE_STACK_END; i = pool[i].chain) {
+        if (pool[i].note == note && pool[i].channel == c)
+            return i;
     }
+    return NOTE_STACK_END;
 }
 
-void note_stack_push(uint8_t channel, uint8_t note)
+static inline void index_add(uint8_t i)
 {
-    uint8_t c = channel - 1;
+    uint8_t *head = bucket(pool[i].channel, pool[i].note);
+
+    pool[i].chain = *head;
+    *head = i;
+}
+
+static inline void index_remove(uint8_t i)
+{
+    uint8_t *link = bucket(pool[i].channel, pool[i].note);
+
+    while (*link != i)
+        link = &pool[*link].chain;
+    *link = pool[i].chain;
+}
+
+static inline void unlink(uint8_t c, uint8_t i)
+{
+    struct entry *e = &pool[i];
 
-    // buffering causes stuck note issues in polyphonic and split mode. also DMC channel behaved better before.
-    // revert to previous behaviour as a workaround. this could be handled better:
-    if (assigner_split || assigner_upper_mode == POLY || assigner_midi_channel_get(CHN_DMC) == channel) {
-        assigner_notify_note_on(channel, note);
-        if (active_notes[c] > 0)
-            clear_note_buffer();
-        else
-            return;
+    if (e->next == i) {
+        newest[c] = NOTE_STACK_END;
+        return;
     }
 
-    if (active_notes[c] < MAX_POLY) {
-        for (int n = 0; n < active_notes[c]; ++n) {
-            if (note_buffer[c][n] == note) {
-                assigner_notify_note_on(channel, note);
-                return;  // if note is already in the buffer, retrigger but don't change the buffer
-            }
-        }
+    pool[e->prev].next = e->next;
+    pool[e->next].prev = e->prev;
 
-        assigner_notify_note_on(channel, note);
+    if (newest[c] == i)
+        newest[c] = e->prev;
+}
+
+static inline void link_newest(uint8_t c, uint8_t i)
+{
+    uint8_t last = newest[c];
 
-        note_buffer[c][active_notes[c]] = note;
-        active_notes[c]++;
+    if (last == NOTE_STACK_END) {
+        pool[i].prev = i;
+        pool[i].next = i;
     }
+    else {
+        uint8_t first = pool[last].next;
+        pool[i].prev = last;
+        pool[i].next = first;
+        pool[last].next = i;
+        pool[first].prev = i;
+    }
+
+    newest[c] = i;
 }
 
-void note_stack_pop(uint8_t channel, uint8_t note)
+static inline void release(uint8_t i)
+{
+    pool[i].next = free_list;
+    free_list = i;
+}
+
+void note_stack_push(uint8_t channel, uint8_t note)
 {
     uint8_t c = channel - 1;
 
-    // buffering causes stuck note issues in polyphonic and split mode. also DMC channel behaved better before.
-    // revert to previous behaviour as a workaround. this could be handled better:
-    if (assigner_split || assigner_upper_mode == POLY || assigner_midi_channel_get(CHN_DMC) == channel) {
-        assigner_notify_note_off(channel, note);
-        if (active_notes[c] > 0)
-            clear_note_buffer();
-        else
-            return;
+    if (!initialized)
+        note_stack_clear();
+
+    uint8_t i = find(c, note);
+    if (i != NOTE_STACK_END) {
+        // Already held, so just make it the most recent
+        unlink(c, i);
     }
+    else {
+        if (free_list != NOTE_STACK_END) {
+            i = free_list;
+            free_list = pool[i].next;
+        }
+        else if (newest[c] != NOTE_STACK_END) {
+            // Out of entries, forget the oldest note on this channel
+            i = pool[newest[c]].next;
+            unlink(c, i);
+            index_remove(i);
+        }
 
-    int note_off_match = 0;
-    for (int n = 0; n < active_notes[c]; ++n) {  // check buffer to see if note is active
-        if (note_buffer[c][n] == note) {
-            note_off_match = 1;
-            if (n < (active_notes[c]-1)) {  // if note is removed from buffer, shift remaining notes down to prevent empty slots
-                note_buffer[c][n] = note_buffer[c][n+1];
-                note_buffer[c][n+1] = note;
-            }
+        if (i != NOTE_STACK_END) {
+            pool[i].note = note;
+            pool[i].channel = c;
+            index_add(i);
         }
     }
 
-    if (note_off_match) {
-        note_off_match = 0;
-        active_notes[c]--;
+    if (i != NOTE_STACK_END)
+        link_newest(c, i);
+
+    assigner_notify_note_on(channel, note);
+}
+
+void note_stack_pop(uint8_t channel, uint8_t note)
+{
+    uint8_t c = channel - 1;
 
-        note_buffer[c][active_notes[c]] = 255;  // remove requested note and play next note in buffer
+    if (!initialized)
+        note_stack_clear();
 
-        if (active_notes[c])
-            assigner_notify_note_on(channel, note_buffer[c][active_notes[c]-1]);
-        else
-            assigner_notify_note_off(channel, note);
+    uint8_t i = find(c, note);
+    if (i != NOTE_STACK_END) {
+        unlink(c, i);
+        index_remove(i);
+        release(i);
     }
+
+    // Always notify, so that a note forgotten by the stack can't get stuck
+    assigner_notify_note_off(channel, note);
+}
+
+uint8_t note_stack_last(uint8_t channel)
+{
+    if (!initialized)
+        return NOTE_STACK_END;
+
+    return newest[channel - 1];
+}
+
+uint8_t note_stack_prev(uint8_t index)
+{
+    struct entry *e = &pool[index];
+
+    // The list wraps around from the oldest note to the newest
+    return (e->prev == newest[e->channel]) ? NOTE_STACK_END : e->prev;
+}
+
+uint8_t note_stack_note(uint8_t index)
+{
+    return pool[index].note;
 }
@@ -20,12 +20,23 @@
 
   Note Stack
 
-  Buffers held notes in monophonic mode, to improve live performace experience.
-  This behavior is called "legato" mode in most synths.
-  In polyphonic mode, or DCM channel, reverts to previous behavior.
+  Keeps track of the held notes on each MIDI channel, in the order they
+  were played. The assigner uses this to return to held notes when a
+  note is released, both in monophonic mode (last note priority) and in
+  polyphonic mode (giving freed channels to notes that lost theirs).
 */
 
+#pragma once
+
 #include <stdint.h>
 
+#define NOTE_STACK_END 0xFF
+
 void note_stack_push(uint8_t channel, uint8_t note);
 void note_stack_pop(uint8_t channel, uint8_t note);
+void note_stack_clear(void);
+
+/* Iteration from the most recently played note towards the oldest */
+uint8_t note_stack_last(uint8_t channel);
+uint8_t note_stack_prev(uint8_t index);
+uint8_t note_stack_note(uint8_t index);
@@ -30,6 +30,7 @@
 #include "envelope/envelope.h"
 #include "lfo/lfo.h"
 #include "modulation/modulation.h"
+#include "modulation/modmatrix.h"
 #include "patch/patch.h"
 #include "portamento/portamento.h"
 #include "assigner/assigner.h"
@@ -77,6 +78,7 @@ const struct parameter parameters[] PROGMEM = {
     [NOISE_LFO1] = {&mod_lfo_modmatrix[3][0], RANGE, 0, 99, 0},
     [NOISE_LFO2] = {&mod_lfo_modmatrix[3][1], RANGE, 0, 99, 0},
     [NOISE_LFO3] = {&mod_lfo_modmatrix[3][2], RANGE, 0, 99, 0},
+    [NOISE_PITCHBEND] = {&mod_pitchbend[3], RANGE, 0, 24, 1},
     [NOISE_VOLMOD] = {&mod_lfo_vol[2], RANGE, 0, 16, 0},
     [NOISE_ENVMOD] = {&mod_envmod[3], RANGE, -9, 9, 0},
     [NOISE_HALF] = {&assigner_upper_mask[3], KBD_HALF, 0, 1, 1},
@@ -108,7 +110,36 @@ const struct parameter parameters[] PROGMEM = {
     [LFO3_PERIOD] = {&lfo[2].period, INVRANGE, 0, 99, 01},
     [LFO3_WAVEFORM] = {(int8_t*)&lfo[2].waveform, RANGE, 1, 5, 1},
 
-    [SPLIT_POINT] = {(int8_t*)&assigner_split_point, NOTE, 24, 84, 48}
+    [SPLIT_POINT] = {(int8_t*)&assigner_split_point, NOTE, 24, 84, 48},
+
+    [MOD1_SOURCE] = {&mod_matrix[0].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD1_DEST] = {&mod_matrix[0].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD1_DEPTH] = {&mod_matrix[0].depth, RANGE, -99, 99, 0},
+
+    [MOD2_SOURCE] = {&mod_matrix[1].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD2_DEST] = {&mod_matrix[1].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD2_DEPTH] = {&mod_matrix[1].depth, RANGE, -99, 99, 0},
+
+    [MOD3_SOURCE] = {&mod_matrix[2].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD3_DEST] = {&mod_matrix[2].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD3_DEPTH] = {&mod_matrix[2].depth, RANGE, -99, 99, 0},
+
+    [MOD4_SOURCE] = {&mod_matrix[3].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD4_DEST] = {&mod_matrix[3].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD4_DEPTH] = {&mod_matrix[3].depth, RANGE, -99, 99, 0},
+
+    [MOD5_SOURCE] = {&mod_matrix[4].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD5_DEST] = {&mod_matrix[4].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD5_DEPTH] = {&mod_matrix[4].depth, RANGE, -99, 99, 0},
+
+    [MOD6_SOURCE] = {&mod_matrix[5].source, RANGE, 0, NUM_MOD_SOURCES - 1, MOD_SRC_OFF},
+    [MOD6_DEST] = {&mod_matrix[5].destination, RANGE, 0, NUM_MOD_DESTINATIONS - 1, MOD_DST_OFF},
+    [MOD6_DEPTH] = {&mod_matrix[5].depth, RANGE, -99, 99, 0},
+
+    [VELOCITY_CURVE] = {&mod_velocity_curve, RANGE, 0, NUM_MOD_CURVES - 1, MOD_CURVE_LINEAR},
+    [AFTERTOUCH_CURVE] = {&mod_aftertouch_curve, RANGE, 0, NUM_MOD_CURVES - 1, MOD_CURVE_LINEAR},
+
+    [UNISON_SPREAD] = {&mod_unison_spread, RANGE, 0, 99, 20}
 };
 
 struct parameter parameter_get(enum parameter_id parameter)
@@ -28,7 +28,7 @@
 
 #include <stdint.h>
 
-#define NUM_PARAMETERS (SPLIT_POINT - SQ1_ENABLED + 1)
+#define NUM_PARAMETERS (UNISON_SPREAD - SQ1_ENABLED + 1)
 
 struct parameter {
     int8_t* target;
@@ -113,7 +113,36 @@ enum parameter_id {
     LFO3_PERIOD,
     LFO3_WAVEFORM,
 
-    SPLIT_POINT
+    SPLIT_POINT,
+
+    MOD1_SOURCE,
+    MOD1_DEST,
+    MOD1_DEPTH,
+
+    MOD2_SOURCE,
+    MOD2_DEST,
+    MOD2_DEPTH,
+
+    MOD3_SOURCE,
+    MOD3_DEST,
+    MOD3_DEPTH,
+
+    MOD4_SOURCE,
+    MOD4_DEST,
+    MOD4_DEPTH,
+
+    MOD5_SOURCE,
+    MOD5_DEST,
+    MOD5_DEPTH,
+
+    MOD6_SOURCE,
+    MOD6_DEST,
+    MOD6_DEPTH,
+
+    VELOCITY_CURVE,
+    AFTERTOUCH_CURVE,
+
+    UNISON_SPREAD
 };
 
 struct parameter parameter_get(enum parameter_id parameter);
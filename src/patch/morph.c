@@ -0,0 +1,139 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+  Patch morphing
+
+  Crossfades the parameters of the current patch towards a second
+  stored patch.
+*/
+
+
+#include <stdbool.h>
+#include "patch/morph.h"
+#include "patch/patch.h"
+#include "parameter/parameter.h"
+#include "modulation/modmatrix.h"
+
+// Number of parameters updated per call, to bound the time spent per tick
+#define MORPH_STEP 16
+
+// Both patches are read from the patch cache, which holds them until the
+// next patch load or save stops the morph
+static const int8_t *from;
+static const int8_t *to;
+
+static uint8_t target = MORPH_OFF;
+static uint8_t position;       // 0 is the current patch, 128 the target
+static uint8_t next_index;     // Next parameter to update in the current sweep
+static bool sweeping;
+static bool matrix_changed;
+
+static inline bool is_stepped(uint8_t id)
+/*
+  Parameters selecting from a list of settings rather than giving an
+  amount. These switch over at the midpoint instead of being interpolated.
+*/
+{
+    switch (id) {
+    case NOISE_LOOP:
+    case DMC_SAMPLE_LOOP:
+    case LFO1_WAVEFORM:
+    case LFO2_WAVEFORM:
+    case LFO3_WAVEFORM:
+    case VELOCITY_CURVE:
+    case AFTERTOUCH_CURVE:
+        return true;
+    default:
+        return id >= MOD1_SOURCE && id <= MOD6_DEPTH && (id - MOD1_SOURCE) % 3 != 2;
+    }
+}
+
+static inline int8_t morph_value(uint8_t id, struct parameter *p)
+{
+    if ((p->type != RANGE && p->type != INVRANGE) || is_stepped(id))
+        return (position < 64) ? from[id] : to[id];
+
+    return from[id] + (((int16_t)to[id] - from[id]) * position >> 7);
+}
+
+void morph_set_target(uint8_t num)
+/*
+  Starts morphing from the current patch towards the given one, starting
+  at the current patch. Patch numbers above PATCH_MAX stop morphing.
+*/
+{
+    if (num > PATCH_MAX) {
+        morph_stop();
+        return;
+    }
+
+    from = patch_cached(patch_current);
+    to = patch_cached(num);
+    target = num;
+    position = 0;
+}
+
+void morph_set_position(uint8_t value)
+/* Sets the morph position from a 0-127 controller value */
+{
+    if (target == MORPH_OFF)
+        return;
+
+    position = value + (value >> 6);
+    next_index = 0;
+    sweeping = true;
+}
+
+void morph_stop(void)
+/* Leaves the parameters as they are and stops following the controller */
+{
+    target = MORPH_OFF;
+    sweeping = false;
+}
+
+void morph_handler(void)
+/*
+  Writes the morphed values, a few parameters per call. A new position
+  restarts the sweep, so a controller sweep never costs more than
+  MORPH_STEP parameters per call.
+*/
+{
+    if (!sweeping)
+        return;
+
+    for (uint8_t i = 0; i < MORPH_STEP && next_index < NUM_PARAMETERS; i++, next_index++) {
+        struct parameter p = parameter_get(next_index);
+        int8_t value = morph_value(next_index, &p);
+
+        if (*p.target != value) {
+            *p.target = value;
+            if (next_index >= MOD1_SOURCE && next_index <= MOD6_DEPTH)
+                matrix_changed = true;
+        }
+    }
+
+    if (next_index == NUM_PARAMETERS) {
+        sweeping = false;
+        if (matrix_changed)
+            mod_matrix_compile();
+        matrix_changed = false;
+    }
+}
@@ -0,0 +1,38 @@
+/*
+  Copyright 2014-2016 Johan Fjeldtvedt
+
+  This file is part of NESIZER.
+
+  NESIZER is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  NESIZER is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with NESIZER.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+  Patch morphing
+
+  Crossfades the parameters of the current patch towards a second
+  stored patch.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+
+#define MORPH_OFF 0xFF
+
+void morph_set_target(uint8_t num);
+void morph_set_position(uint8_t value);
+void morph_stop(void);
+void morph_handler(void);
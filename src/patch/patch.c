@@ -24,46 +24,295 @@
 */
 
 
+#include <stdbool.h>
 #include "patch/patch.h"
 #include "io/memory.h"
+#include "integrity/integrity.h"
 #include "parameter/parameter.h"
+#include "modulation/modmatrix.h"
+#include "macro/macro.h"
+#include "task/task.h"
+#include "patch/morph.h"
 
-// First 256 bytes of SRAM not used.
-#define PATCH_START 0x100
+const uint16_t PATCH_MEMORY_END;
 
-#define PATCH_SIZE NUM_PARAMETERS
+uint16_t patch_load_latency;
+uint8_t patch_current;
 
-const uint16_t PATCH_MEMORY_END;
+/*
+  Recently used patches are kept in a small cache, so that switching
+  between a few patches doesn't have to go to SRAM. A loaded patch is
+  staged in its cache entry and committed by the patch commit task, so
+  that the whole patch takes effect between two modulation updates
+  instead of being mixed with the previous one.
 
-void patch_initialize(uint8_t num)
-/* Initializes patch memory by writing initial values to the patch memory */
+  The entries also hold the patches being morphed between, so that
+  morphing doesn't need its own copies of them, and a saved patch is
+  gathered in its entry instead of on the stack.
+*/
+#define CACHE_SIZE 4
+#define CACHE_EMPTY 0xFF
+
+static int8_t cache[CACHE_SIZE][NUM_PARAMETERS];
+static uint8_t cache_patches[CACHE_SIZE] = {CACHE_EMPTY, CACHE_EMPTY, CACHE_EMPTY, CACHE_EMPTY};
+static uint8_t cache_stamps[CACHE_SIZE];
+static uint8_t cache_count;
+
+uint16_t patch_cache_hits;
+uint16_t patch_cache_misses;
+
+static uint8_t pending_entry = CACHE_EMPTY;
+static uint8_t pending_patch;
+static uint16_t load_time;
+
+static uint8_t cache_entry(uint8_t num)
+/* Returns the cache entry holding the patch, or the one to replace with it */
 {
-    uint16_t address = PATCH_START + PATCH_SIZE * num;
+    uint8_t entry = 0;
+    uint8_t oldest_age = 0;
 
-    for (uint8_t i = 0; i < NUM_PARAMETERS; i++) {
-        struct parameter data = parameter_get(i);
-        memory_write(address++, data.initial_value);
+    for (uint8_t i = 0; i < CACHE_SIZE; i++) {
+        if (cache_patches[i] == num)
+            return i;
+
+        // Empty entries are used first, otherwise the least recently used
+        uint8_t age = (cache_patches[i] == CACHE_EMPTY) ? 0xFF : (uint8_t)(cache_count - cache_stamps[i]);
+        if (age >= oldest_age) {
+            oldest_age = age;
+            entry = i;
+        }
+    }
+
+    return entry;
+}
+
+static uint8_t cache_lookup(uint8_t num)
+/* Returns the cache entry holding the patch, reading it in on a miss */
+{
+    uint8_t entry = cache_entry(num);
+
+    if (cache_patches[entry] == num) {
+        patch_cache_hits++;
+    }
+    else {
+        patch_cache_misses++;
+        patch_read(num, cache[entry]);
+        cache_patches[entry] = num;
+    }
+
+    cache_stamps[entry] = ++cache_count;
+    return entry;
+}
+
+static void cache_invalidate(uint8_t num)
+{
+    for (uint8_t i = 0; i < CACHE_SIZE; i++) {
+        if (cache_patches[i] == num)
+            cache_patches[i] = CACHE_EMPTY;
+    }
+}
+
+/*
+  Patches are stored in a tagged format: a format tag, the number of
+  parameter IDs covered, a bitmap of the IDs whose value differs from the
+  initial value, and the values of those parameters in ID order. New
+  parameters are appended to the parameter list, so they simply take
+  their initial value in patches saved before they existed.
+*/
+#define BITMAP_SIZE(count) (((count) + 7) / 8)
+#define HEADER_SIZE 2
+
+_Static_assert(HEADER_SIZE + BITMAP_SIZE(NUM_PARAMETERS) + NUM_PARAMETERS <= PATCH_MACRO_OFFSET,
+               "Patch parameters overlap the macros");
+
+// Patches as saved by the first firmware
+#define OLD_PATCH_START 0x100
+#define OLD_PATCH_SIZE 64
+
+_Static_assert(OLD_PATCH_SIZE <= NUM_PARAMETERS, "Parameters of old patches are missing");
+
+static inline uint32_t patch_address(uint8_t num)
+{
+    return PATCH_START + (uint32_t)PATCH_SIZE * num;
+}
+
+static inline bool bit_set(const uint8_t *bitmap, uint8_t id)
+{
+    return bitmap[id / 8] & (1 << (id % 8));
+}
+
+static void unpack(int8_t *values, const uint8_t *bitmap, uint8_t count, uint8_t n)
+/*
+  Moves the n values packed at the start of the array out to their IDs,
+  and gives the other parameters their initial values. This is done from
+  the end, since a value is never moved to a lower index.
+*/
+{
+    for (uint8_t id = NUM_PARAMETERS; id-- > 0; ) {
+        if (id < count && bit_set(bitmap, id))
+            values[id] = values[--n];
+        else
+            values[id] = parameter_get(id).initial_value;
+    }
+}
+
+static void encode(uint32_t address, int8_t *values)
+/*
+  Stores the values of a patch. The changed values are packed to the
+  start of the array while they are written, and moved back afterwards.
+*/
+{
+    uint8_t header[HEADER_SIZE + BITMAP_SIZE(NUM_PARAMETERS)] = {PATCH_FORMAT_TAG};
+    uint8_t *bitmap = &header[HEADER_SIZE];
+    uint8_t count = 0;
+    uint8_t n = 0;
+
+    for (uint8_t id = 0; id < NUM_PARAMETERS; id++) {
+        if (values[id] == parameter_get(id).initial_value)
+            continue;
+
+        // A value is never moved to a higher index, so this is done in place
+        bitmap[id / 8] |= 1 << (id % 8);
+        values[n++] = values[id];
+        count = id + 1;
     }
+
+    // Only the IDs up to the last changed parameter are covered
+    header[1] = count;
+    memory_write_burst(address, header, HEADER_SIZE + BITMAP_SIZE(count));
+    memory_write_burst(address + HEADER_SIZE + BITMAP_SIZE(count), (uint8_t*)values, n);
+
+    unpack(values, bitmap, count, n);
+}
+
+void patch_read(uint8_t num, int8_t *values)
+/* Reads the parameter values of a stored patch */
+{
+    uint32_t address = patch_address(num);
+    uint8_t header[HEADER_SIZE + BITMAP_SIZE(0xFF)];
+    uint8_t *bitmap = &header[HEADER_SIZE];
+
+    integrity_require(INTEGRITY_PATCH(num));
+    memory_read_burst(address, header, HEADER_SIZE);
+    uint8_t count = (header[0] == PATCH_FORMAT_TAG) ? header[1] : 0;
+    memory_read_burst(address + HEADER_SIZE, bitmap, BITMAP_SIZE(count));
+
+    // Parameters from newer firmware are stored last and are left out
+    uint8_t known = (count < NUM_PARAMETERS) ? count : NUM_PARAMETERS;
+    uint8_t n = 0;
+    for (uint8_t id = 0; id < known; id++) {
+        if (bit_set(bitmap, id))
+            n++;
+    }
+
+    memory_read_burst(address + HEADER_SIZE + BITMAP_SIZE(count), (uint8_t*)values, n);
+    unpack(values, bitmap, known, n);
+}
+
+void patch_migrate(void)
+/*
+  Moves the patches saved by the first firmware to the patch slots. It
+  kept the values of the first 64 parameters as a plain array for each
+  patch, in the otherwise unused low memory, and had no macros. The
+  edit buffer's macros are cleared as well.
+*/
+{
+    int8_t values[NUM_PARAMETERS];
+
+    for (uint8_t num = 0; num <= PATCH_MAX; num++) {
+        memory_read_burst(OLD_PATCH_START + OLD_PATCH_SIZE * num, (uint8_t*)values, OLD_PATCH_SIZE);
+        for (uint8_t id = OLD_PATCH_SIZE; id < NUM_PARAMETERS; id++)
+            values[id] = parameter_get(id).initial_value;
+
+        cache_invalidate(num);
+        integrity_touch(INTEGRITY_PATCH(num));
+        encode(patch_address(num), values);
+        macro_initialize(patch_address(num) + PATCH_MACRO_OFFSET);
+    }
+
+    macro_initialize(patch_address(PATCH_EDIT_BUFFER) + PATCH_MACRO_OFFSET);
+}
+
+void patch_initialize(uint8_t num)
+/* Initializes patch memory with all parameters at their initial values */
+{
+    uint8_t header[HEADER_SIZE] = {PATCH_FORMAT_TAG, 0};
+
+    cache_invalidate(num);
+    integrity_touch(INTEGRITY_PATCH(num));
+    memory_write_burst(patch_address(num), header, HEADER_SIZE);
+
+    macro_initialize(patch_address(num) + PATCH_MACRO_OFFSET);
 }
 
 void patch_save(uint8_t num)
 {
-    uint16_t address = PATCH_START + PATCH_SIZE * num;
+    // Make sure a patch still being loaded isn't mixed into the saved one
+    patch_commit_handler();
 
+    // A morph reads its patches from cache entries that may be reused here
+    morph_stop();
+
+    // Touched first, since formatting the patch invalidates its entry
+    integrity_touch(INTEGRITY_PATCH(num));
+
+    // The values are gathered in the patch's cache entry, which then
+    // holds the saved patch
+    uint8_t entry = cache_entry(num);
     for (uint8_t i = 0; i < NUM_PARAMETERS; i++) {
         struct parameter data = parameter_get(i);
-        memory_write(address++, *data.target);
+        cache[entry][i] = *data.target;
     }
+    cache_patches[entry] = num;
+    cache_stamps[entry] = ++cache_count;
+
+    encode(patch_address(num), cache[entry]);
+
+    macro_save(patch_address(num) + PATCH_MACRO_OFFSET);
+}
+
+const int8_t *patch_cached(uint8_t num)
+/*
+  Returns the values of a stored patch from the cache. As the least
+  recently used entry is replaced, the values returned by the last four
+  calls stay valid until the next patch_load or patch_save.
+*/
+{
+    // A staged patch must not be replaced before it is committed
+    patch_commit_handler();
+    return cache[cache_lookup(num)];
 }
 
 void patch_load(uint8_t num)
+/* Stages a patch from the cache. It is heard once committed. */
 {
-    uint16_t address = PATCH_START + PATCH_SIZE * num;
+    // A morph reads its patches from the cache entries that are reused here
+    morph_stop();
+
+    load_time = task_time();
+    pending_entry = cache_lookup(num);
+    pending_patch = num;
+}
+
+void patch_commit_handler(void)
+/* Applies a staged patch to the parameters */
+{
+    if (pending_entry == CACHE_EMPTY)
+        return;
 
     for (uint8_t i = 0; i < NUM_PARAMETERS; i++) {
         struct parameter data = parameter_get(i);
-        *data.target = memory_read(address++);
+        *data.target = cache[pending_entry][i];
     }
+
+    mod_matrix_compile();
+
+    // The macros are copied in over the following macro handler calls
+    macro_load(patch_address(pending_patch) + PATCH_MACRO_OFFSET);
+    pending_entry = CACHE_EMPTY;
+    patch_current = pending_patch;
+
+    patch_load_latency = task_time() - load_time;
 }
 
 uint8_t patch_pc_limit(int8_t* patch_num, int8_t min, int8_t max, int8_t pc_num)
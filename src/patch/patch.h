@@ -27,14 +27,42 @@
 #pragma once
 
 #include <stdint.h>
+#include "io/memory.h"
 
 #define PATCH_MIN 0
 #define PATCH_MAX 99
 
+#define PATCH_START MEMORY_PATCH_START
+
+// Each patch has a fixed size slot, with the parameters first followed
+// by the macros
+#define PATCH_SIZE 512
+#define PATCH_MACRO_OFFSET 128
+
+// First byte of a patch in the current format
+#define PATCH_FORMAT_TAG 0x81
+
+// Slot after the last patch, holding the macros of the current sound
+#define PATCH_EDIT_BUFFER (PATCH_MAX + 1)
+
 extern const uint16_t PATCH_MEMORY_END;
 
+// Ticks (1/16025 s) from the last patch_load call until the patch was heard
+extern uint16_t patch_load_latency;
+
+// The patch last loaded
+extern uint8_t patch_current;
+
+// Program changes served from the RAM patch cache, and those read from SRAM
+extern uint16_t patch_cache_hits;
+extern uint16_t patch_cache_misses;
+
 void patch_save(uint8_t num);
+void patch_read(uint8_t num, int8_t *values);
+const int8_t *patch_cached(uint8_t num);
+void patch_migrate(void);
 void patch_load(uint8_t num);
+void patch_commit_handler(void);
 void patch_initialize(uint8_t num);
 void patch_clean(void);
 uint8_t patch_pc_limit(int8_t* patch_num, int8_t min, int8_t max, int8_t pc_num);
@@ -20,40 +20,77 @@
 
   Portamento implementation
 
-  A simple portamento implementation. Computes delta values in cents
-  to be applied by modulation.
+  Constant time portamento. The glide setting is a time rather than a
+  rate: when a note starts, the distance to the new note is divided by the
+  glide time to get a fixed point increment, so the handler only has to add
+  the increment for each channel that is currently gliding.
 */
 
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "portamento/portamento.h"
 #include "modulation/modulation.h"
 
 int8_t portamento_values[3] = {0};
 uint16_t portamento_cs[3] = {0};
-uint8_t portamento_target_notes[3] = {0};
+int8_t portamento_legato;
 
-static uint8_t counters[3] = {0};
+// Current pitch and increment per handler call, in 1/64 semitones with
+// 8 extra fractional bits
+static int32_t position[3];
+static int32_t increment[3];
+static uint16_t remaining[3];
+static uint16_t targets[3];
 
 static inline uint16_t note_to_c(uint8_t note)
 {
   return note << 6;
 }
 
+static inline uint16_t glide_steps(uint8_t value)
+/*
+  Converts a glide setting (1-99) to a number of handler calls. The curve
+  is quadratic to give finer control of short glides. At 1.6 kHz this
+  ranges from about 1 ms to 3 seconds.
+*/
+{
+  return (uint16_t)value * value / 2 + 1;
+}
+
+void portamento_note_on(uint8_t chn, uint8_t note, bool legato)
+/*
+  Starts a glide towards the given note. If glide is off, or legato only
+  mode is enabled and the note was not played legato, the pitch jumps
+  directly to the note.
+*/
+{
+  targets[chn] = note_to_c(note);
+
+  if (portamento_values[chn] == 0 || (portamento_legato && !legato)) {
+    remaining[chn] = 0;
+    position[chn] = (int32_t)targets[chn] << 8;
+    portamento_cs[chn] = targets[chn];
+    return;
+  }
+
+  uint16_t steps = glide_steps(portamento_values[chn]);
+  increment[chn] = (((int32_t)targets[chn] << 8) - position[chn]) / steps;
+  remaining[chn] = steps;
+}
+
 void portamento_handler(void)
 {
   for (uint8_t i = 0; i < 3; i++) {
-    if (portamento_values[i] == 0)
-      portamento_cs[i] = (uint16_t)portamento_target_notes[i] << 6;
-    else {
-      if (++counters[i] == portamento_values[i]) {
-	counters[i] = 0;
-	if (portamento_cs[i] > note_to_c(portamento_target_notes[i]))
-	  portamento_cs[i]--;
-	else if (portamento_cs[i] < note_to_c(portamento_target_notes[i]))
-	  portamento_cs[i]++;
-      }
-    }
+    if (remaining[i] == 0)
+      continue;
+
+    position[i] += increment[i];
+
+    // Land exactly on the target to get rid of rounding errors
+    if (--remaining[i] == 0)
+      position[i] = (int32_t)targets[i] << 8;
+
+    portamento_cs[i] = position[i] >> 8;
   }
 }
-
@@ -20,15 +20,19 @@
 
   Portamento implementation
 
-  A simple portamento implementation. Computes delta values in cents
+  Constant time portamento. Computes the current pitch in 1/64 semitones
   to be applied by modulation.
 */
 
 
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+
 extern int8_t portamento_values[3];
 extern uint16_t portamento_cs[3];
-extern uint8_t portamento_target_notes[3];
+extern int8_t portamento_legato;
 
+void portamento_note_on(uint8_t chn, uint8_t note, bool legato);
 void portamento_handler(void);
@@ -26,22 +26,29 @@
 
 #include "sample.h"
 #include "io/memory.h"
+#include "integrity/integrity.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 #define NUM_SAMPLES 100
 
-// 256b empty + 6400b patches + 16000b patterns
-#define INDEX_START 22656
+#define INDEX_START SAMPLE_INDEX_START
 
 #define INDEX_ENTRY_SIZE 8
 #define INDEX_SIZE (INDEX_ENTRY_SIZE * NUM_SAMPLES)
 
-#define BLOCKTABLE_START (INDEX_START + INDEX_SIZE)
+#define BLOCKTABLE_START SAMPLE_BLOCKTABLE_START
 #define BLOCK_SIZE 1024
-#define BLOCKTABLE_SIZE 1024*2
-#define BLOCK_START BLOCKTABLE_START + BLOCKTABLE_SIZE
+#define BLOCKTABLE_SIZE SAMPLE_BLOCKTABLE_SIZE
+#define BLOCK_START (BLOCKTABLE_START + BLOCKTABLE_SIZE)
 
-#define NUM_BLOCKS (MEMORY_SIZE - BLOCK_START) / BLOCK_SIZE
+// Blocks must not extend into the reserved memory area
+#define NUM_BLOCKS ((MEMORY_RESERVED_START - BLOCK_START) / BLOCK_SIZE)
+
+_Static_assert(INDEX_SIZE == SAMPLE_INDEX_SIZE, "Sample index size mismatch");
+
+// Returned by allocate_block when the sample memory is full
+#define BLOCK_NONE 0xFFFF
 
 /* Internal functions */
 
@@ -62,6 +69,8 @@ static inline uint8_t index_occupied(uint8_t index);
 
 void sample_clear_all(void)
 {
+    integrity_touch(INTEGRITY_SAMPLE_INDEX);
+    integrity_touch(INTEGRITY_BLOCK_TABLE);
     for (uint32_t i = 0; i < INDEX_ENTRY_SIZE * NUM_SAMPLES; i++) {
         memory_write(INDEX_START + i, 0);
     }
@@ -108,11 +117,16 @@ void sample_new(struct sample *sample, uint8_t index)
     sample->first_block = allocate_block();
     sample_reset(sample);
 
-    write_to_index(sample, index);
+    if (sample->first_block != BLOCK_NONE)
+        write_to_index(sample, index);
 }
 
 void sample_write_serial(struct sample *sample, uint8_t value)
 {
+    // Memory is full, drop the data
+    if (sample->current_block == BLOCK_NONE)
+        return;
+
     write_to_block(&sample->mem_ctx, sample->current_block, sample->current_position, value);
 
     sample->bytes_done++;
@@ -120,7 +134,8 @@ void sample_write_serial(struct sample *sample, uint8_t value)
     if (++sample->current_position == BLOCK_SIZE) {
         sample->current_position = 0;
         uint16_t new_block = allocate_block();
-        link_blocks(sample->current_block, new_block);
+        if (new_block != BLOCK_NONE)
+            link_blocks(sample->current_block, new_block);
         sample->current_block = new_block;
     }
 }
@@ -162,6 +177,39 @@ uint8_t sample_occupied(uint8_t index)
     return index_occupied(index);
 }
 
+void sample_release_reserved(void)
+/*
+  Deletes samples with data in blocks that are now part of the reserved
+  memory area, after the reserved area has grown. A chain longer than
+  the number of blocks is damaged and is only dropped from the index.
+*/
+{
+    for (uint8_t index = 0; index < NUM_SAMPLES; index++) {
+        if (!index_occupied(index))
+            continue;
+
+        struct sample sample;
+        read_from_index(&sample, index);
+
+        uint16_t block_index = sample.first_block;
+        uint16_t block_entry;
+        uint16_t length = 0;
+        bool reserved = false;
+
+        do {
+            if (block_index >= NUM_BLOCKS)
+                reserved = true;
+            block_entry = read_block_entry(block_index);
+            block_index = next_block_index(block_entry);
+        } while (!end_of_chain(block_entry) && ++length < BLOCKTABLE_SIZE / 2);
+
+        if (!end_of_chain(block_entry))
+            remove_from_index(index);
+        else if (reserved)
+            sample_delete(index);
+    }
+}
+
 
 /* Internal function definitions */
 
@@ -174,6 +222,7 @@ static inline void link_blocks(uint16_t block_index, uint16_t next_block_index)
 /* Write the next block number at the block's location in the block table */
 {
     /* Note: this keeps the block tree state, but removes the end of chain flag */
+    integrity_touch(INTEGRITY_BLOCK_TABLE);
     uint16_t block_state = memory_read(BLOCKTABLE_START + block_index * 2 + 1) & 0x3c;
     uint16_t block_entry = (block_state << 8) | next_block_index;
     memory_write_word(BLOCKTABLE_START + block_index * 2, block_entry);
@@ -255,6 +304,8 @@ static uint16_t allocate_block(void)
     uint8_t next_child = 0;
     uint8_t block_entry_upper;
 
+    integrity_touch(INTEGRITY_BLOCK_TABLE);
+
     for (uint8_t level = 0; level < 5; level++) {
         logical_block_index |= next_child;
         logical_block_index <<= 2;
@@ -268,6 +319,11 @@ static uint16_t allocate_block(void)
 
     uint16_t new_block_index = logical_block_index | next_child;
 
+    /* Blocks are allocated lowest first, so when this is past the end
+       all usable blocks are taken */
+    if (next_child == 0xff || new_block_index >= NUM_BLOCKS)
+        return BLOCK_NONE;
+
     // Mark block as end of chain
     block_entry_upper = memory_read(BLOCKTABLE_START + 2 * new_block_index + 1) | 0x80;
     memory_write(BLOCKTABLE_START + 2 * new_block_index + 1, block_entry_upper);
@@ -307,6 +363,8 @@ static void free_block(uint16_t block_index)
 {
     uint16_t logical_block_index = block_index;
 
+    integrity_touch(INTEGRITY_BLOCK_TABLE);
+
     for (int8_t level = 4; level >= 0; level--) {
         uint8_t child_index = logical_block_index & 0x03;
         logical_block_index &= ~0x03;
@@ -343,6 +401,8 @@ static void write_to_index(struct sample *sample, uint8_t index)
 {
     uint32_t address = index_address(index);
 
+    integrity_touch(INTEGRITY_SAMPLE_INDEX);
+
     // Mark index as occupied
     memory_write(address++, 1);
 
@@ -369,6 +429,7 @@ static void read_from_index(struct sample *sample, uint8_t index)
 
 static void remove_from_index(uint8_t index)
 {
+    integrity_touch(INTEGRITY_SAMPLE_INDEX);
     memory_write(index_address(index), 0);
 }
 
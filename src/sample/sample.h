@@ -34,6 +34,13 @@
 
 #define SAMPLE_MIDI_LOW_INDEX 36
 
+// 256b settings + 22400b unused (formerly patches and patterns)
+#define SAMPLE_INDEX_START 22656
+#define SAMPLE_INDEX_SIZE (8 * 100)
+
+#define SAMPLE_BLOCKTABLE_START (SAMPLE_INDEX_START + SAMPLE_INDEX_SIZE)
+#define SAMPLE_BLOCKTABLE_SIZE (1024 * 2)
+
 struct sample {
   uint8_t type;
   uint32_t size;
@@ -55,3 +62,4 @@ uint8_t sample_read_byte(struct sample *sample);
 void sample_delete(uint8_t index);
 uint8_t sample_occupied(uint8_t index);
 void sample_write_serial(struct sample *sample, uint8_t value);
+void sample_release_reserved(void);
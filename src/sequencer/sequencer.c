@@ -18,68 +18,586 @@
 
 
 
+
   Sequencer
 
 */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
 #include "sequencer.h"
 #include "assigner/assigner.h"
+#include "apu/apu.h"
 #include "io/memory.h"
 #include "io/midi.h"
 #include "settings/settings.h"
+#include "parameter/parameter.h"
+#include "modulation/modulation.h"
+#include "task/task.h"
+#include "integrity/integrity.h"
+
+#define PATTERN_START MEMORY_PATTERN_START
+#define PATTERN_SIZE SEQUENCER_PATTERN_SIZE
+
+// Two slots after the last pattern hold the pattern being edited, and
+// the next one while it is prefetched during playback
+#define PATTERN_EDIT_BUFFER SEQUENCER_NUM_PATTERNS
+#define NUM_EDIT_BUFFERS 2
 
-#define SEQUENCER_START 6656
-#define PATTERN_SIZE 162 // 2 * 5 * 16 + 2
+// First byte of a pattern in the current format
+#define PATTERN_FORMAT_TAG 0x81
+
+/*
+  Each pattern starts with a header, followed by the steps. A step holds
+  a note record for each channel, so that a whole step can be read at
+  once. A note record is the note, the length and lock type packed in
+  one byte, and the lock value. The step delay is kept in the bits left
+  over: its two low bits at the top of the second byte, and its high bit
+  at the top of the note byte.
+*/
+#define HEADER_SCALE 1
+#define HEADER_END_POINT 2
+#define HEADER_CHAIN 3
+#define HEADER_SWING 4
+#define HEADER_SIZE 8
+#define NOTE_SIZE 3
+#define STEP_SIZE (5 * NOTE_SIZE)
+
+_Static_assert(HEADER_SIZE + SEQUENCER_MAX_STEPS * STEP_SIZE <= PATTERN_SIZE,
+               "Pattern steps don't fit in a pattern slot");
+_Static_assert(PATTERN_START + (uint32_t)PATTERN_SIZE * (PATTERN_EDIT_BUFFER + NUM_EDIT_BUFFERS) <= MEMORY_PATCH_START,
+               "Patterns overlap the patches");
+
+// Patterns as stored by the first firmware: 16 steps of note and length
+// for each channel, followed by the scale and end point
+#define OLD_PATTERN_START 6656
+#define OLD_PATTERN_SIZE 162
 
 #define ENTER_NOTE_COUNT 100
 
+// Bytes of a queued pattern copied per sequencer handler call
+#define PREFETCH_CHUNK 32
+
+#define NO_PARAMETER 0xFF
+
+// Sequencer sub-steps per step
+#define STEP_TICKS 6
+
 struct sequencer_pattern sequencer_pattern;
 
-uint8_t sequencer_tempo_count = 10;
+uint16_t sequencer_tempo = SEQUENCER_TEMPO_DEFAULT;
 uint8_t sequencer_cur_position;
 int8_t sequencer_ext_clock;
 uint8_t sequencer_midi_note;
 int8_t sequencer_midi_out_channels[5];
+uint8_t sequencer_loaded_pattern;
 
 static uint8_t duration_counter;
 static uint8_t tempo_counter;
 static uint8_t midi_clock_count;
+static uint8_t tempo_pulses;
 static uint8_t record_chn;
 
 static enum { SINGLE_NOTE, PLAY, RECORD, STOP } mode = STOP;
 
 uint8_t enter_note_chn;
 
+/* The pattern being played, either the edited one or one it chains to */
+static const struct sequencer_pattern *playing = &sequencer_pattern;
+static struct sequencer_pattern chained;
+static uint32_t play_address;
+
+/* The step being played */
+static struct sequencer_note step[5];
+
+/*
+  The step to be started next is read ahead by sequencer_handler, along
+  with where it was read from, so that tick() never reads memory. A step
+  that isn't ready when it is due is played as a rest.
+*/
+static struct sequencer_note upcoming[5];
+static uint32_t upcoming_address;
+static uint8_t upcoming_pos;
+static bool upcoming_ready;
+
+uint16_t sequencer_step_misses;
+
+static uint8_t edit_buffer;
+
+/*
+  The pattern to continue with at the end point, either queued by the
+  user or chained from the playing pattern. It is prefetched in the
+  background from the start of the playing pattern, so that switching to
+  it in tick() costs no memory access: a queued pattern is copied to the
+  spare edit buffer a chunk at a time, then the header is read. Its first
+  step is read as the upcoming step.
+*/
+static struct {
+    uint8_t pattern;
+    bool queued;
+    bool ready;
+    uint16_t copied;
+    uint32_t address;
+    struct sequencer_pattern header;
+} next;
+
+/*
+  Notes are started and stopped at their grid position, delayed by the
+  swing and the step delay. The delays are counted in timer ticks, so
+  that they don't depend on how often tick() runs, and the events are
+  sent by sequencer_timing_handler. The time is task_time(), which MIDI
+  messages are also stamped with when received.
+*/
+static uint16_t now;
+static uint16_t tick_time;
+static uint16_t step_time;
+static uint16_t step_length;
+static uint16_t swing_delay;
+
+static struct {
+    uint16_t on_time;
+    uint16_t off_time;
+    uint8_t off_note;
+    bool on_pending;
+    bool off_pending;
+} events[5];
+
+/*
+  Notes being recorded, held down on the MIDI channel they were played
+  on. Playback of the channel is muted until the note is released.
+*/
+static struct {
+    bool held;
+    uint8_t midi_channel;
+    uint8_t note;
+    uint8_t pos;
+    uint16_t time;
+} recording[5];
+
+/* Parameter values replaced by the lock of the playing note */
+static int8_t *lock_targets[5];
+static int8_t lock_saved[5];
+
+static const uint8_t lock_parameters[5][NUM_LOCKS] PROGMEM = {
+    {NO_PARAMETER, SQ1_DUTY, NO_PARAMETER, SQ1_LFO1, SQ1_LFO2, SQ1_LFO3},
+    {NO_PARAMETER, SQ2_DUTY, NO_PARAMETER, SQ2_LFO1, SQ2_LFO2, SQ2_LFO3},
+    {NO_PARAMETER, NO_PARAMETER, NO_PARAMETER, TRI_LFO1, TRI_LFO2, TRI_LFO3},
+    {NO_PARAMETER, NO_PARAMETER, NO_PARAMETER, NOISE_LFO1, NOISE_LFO2, NOISE_LFO3},
+    {NO_PARAMETER, NO_PARAMETER, NO_PARAMETER, NO_PARAMETER, NO_PARAMETER, NO_PARAMETER}
+};
+
 void tick(void);
 
-struct memory_context ctx;
+static const struct sequencer_pattern empty_pattern = {
+    .scale = 2, .end_point = 16, .chain = SEQUENCER_NO_CHAIN
+};
+
+static inline uint32_t pattern_address(uint8_t pattern)
+{
+    return PATTERN_START + (uint32_t)PATTERN_SIZE * pattern;
+}
+
+static inline uint32_t note_address(uint32_t pattern, uint8_t pos, uint8_t chn)
+{
+    return pattern + HEADER_SIZE + (uint16_t)pos * STEP_SIZE + chn * NOTE_SIZE;
+}
+
+static inline uint32_t edit_address(void)
+{
+    return pattern_address(PATTERN_EDIT_BUFFER + edit_buffer);
+}
+
+static inline uint32_t spare_address(void)
+{
+    return pattern_address(PATTERN_EDIT_BUFFER + (edit_buffer ^ 1));
+}
+
+static inline void decode_note(const uint8_t *data, struct sequencer_note *note)
+{
+    note->note = data[0] & 0x7F;
+    note->length = data[1] & 0x07;
+    note->lock = (data[1] >> 3) & 0x07;
+    note->lock_value = data[2];
+    note->delay = (data[1] >> 6) | ((data[0] >> 5) & 0x04);
+}
+
+static inline void encode_note(const struct sequencer_note *note, uint8_t *data)
+{
+    data[0] = (note->note & 0x7F) | ((note->delay & 0x04) << 5);
+    data[1] = (note->length & 0x07) | ((note->lock & 0x07) << 3) | (note->delay << 6);
+    data[2] = note->lock_value;
+}
+
+static void read_header(uint32_t address, struct sequencer_pattern *pattern)
+{
+    pattern->scale = memory_read(address + HEADER_SCALE);
+    pattern->end_point = memory_read(address + HEADER_END_POINT);
+    pattern->chain = memory_read(address + HEADER_CHAIN);
+    pattern->swing = memory_read(address + HEADER_SWING);
+
+    if (pattern->end_point < 1 || pattern->end_point > SEQUENCER_MAX_STEPS)
+        pattern->end_point = 16;
+    if (pattern->swing < SEQUENCER_SWING_MIN || pattern->swing > SEQUENCER_SWING_MAX)
+        pattern->swing = SEQUENCER_SWING_MIN;
+}
+
+static void write_header(uint32_t address, const struct sequencer_pattern *pattern)
+{
+    uint8_t header[HEADER_SIZE] = {
+        PATTERN_FORMAT_TAG,
+        [HEADER_SCALE] = pattern->scale,
+        [HEADER_END_POINT] = pattern->end_point,
+        [HEADER_CHAIN] = pattern->chain,
+        [HEADER_SWING] = pattern->swing
+    };
+    memory_write_burst(address, header, HEADER_SIZE);
+}
+
+static void copy_pattern(uint32_t to, uint32_t from)
+{
+    uint8_t buffer[32];
+
+    for (uint16_t i = 0; i < PATTERN_SIZE; i += sizeof(buffer)) {
+        memory_read_burst(from + i, buffer, sizeof(buffer));
+        memory_write_burst(to + i, buffer, sizeof(buffer));
+    }
+}
+
+static void clear_steps(uint32_t address)
+{
+    uint8_t zeros[STEP_SIZE] = {0};
+
+    for (uint8_t pos = 0; pos < SEQUENCER_MAX_STEPS; pos++)
+        memory_write_burst(note_address(address, pos, 0), zeros, STEP_SIZE);
+}
+
+static void read_step(uint32_t address, uint8_t pos, struct sequencer_note *notes)
+/* Reads the notes of all channels at a step */
+{
+    uint8_t data[STEP_SIZE];
+
+    memory_read_burst(note_address(address, pos, 0), data, STEP_SIZE);
+    for (uint8_t chn = 0; chn < 5; chn++)
+        decode_note(&data[chn * NOTE_SIZE], &notes[chn]);
+}
+
+static void prefetch(void)
+/* Does a bounded amount of work towards having the next pattern ready */
+{
+    if (next.queued) {
+        if (next.ready)
+            return;
+
+        if (next.copied < PATTERN_SIZE) {
+            uint8_t buffer[PREFETCH_CHUNK];
+            memory_read_burst(pattern_address(next.pattern) + next.copied, buffer, PREFETCH_CHUNK);
+            memory_write_burst(spare_address() + next.copied, buffer, PREFETCH_CHUNK);
+            next.copied += PREFETCH_CHUNK;
+            return;
+        }
+
+        next.address = spare_address();
+    }
+    else {
+        int8_t chain = playing->chain;
+        if (mode != PLAY || chain < 0 || chain > 99)
+            return;
+
+        // The chain may have been changed since it was prefetched
+        if (next.ready && next.pattern == chain)
+            return;
+
+        integrity_require(INTEGRITY_PATTERN(chain));
+        next.pattern = chain;
+        next.address = pattern_address(chain);
+    }
+
+    read_header(next.address, &next.header);
+    next.ready = true;
+}
+
+static void following_step(uint32_t *address, uint8_t *pos)
+/* Gives the step that tick() starts next */
+{
+    *address = play_address;
+    *pos = sequencer_cur_position;
+    if (duration_counter == 0)
+        return;
+
+    if (++*pos < playing->end_point)
+        return;
+
+    // At the end point, a prefetched pattern is switched to
+    *pos = 0;
+    if (mode == PLAY && next.ready)
+        *address = next.address;
+}
+
+static void prefetch_step(void)
+/* Reads the step that tick() starts next, unless it has been read already */
+{
+    uint32_t address;
+    uint8_t pos;
+    following_step(&address, &pos);
+
+    if (upcoming_ready && upcoming_address == address && upcoming_pos == pos)
+        return;
+
+    read_step(address, pos, upcoming);
+    upcoming_address = address;
+    upcoming_pos = pos;
+    upcoming_ready = true;
+}
+
+void sequencer_pattern_queue(uint8_t pattern)
+/*
+  Selects a pattern for editing and playback. While playing, the switch
+  happens at the end point of the playing pattern.
+*/
+{
+    if (mode != PLAY && mode != RECORD) {
+        sequencer_pattern_load(pattern);
+        return;
+    }
+
+    integrity_require(INTEGRITY_PATTERN(pattern));
+    next.pattern = pattern;
+    next.queued = true;
+    next.ready = false;
+    next.copied = 0;
+}
+
+static int8_t *lock_target(uint8_t chn, uint8_t lock)
+{
+    if (lock == LOCK_VOLUME)
+        return (chn == CHN_TRI || chn == CHN_DMC) ? NULL : (int8_t*)&mod_step_volume[chn];
+
+    if (lock >= NUM_LOCKS)
+        return NULL;
+
+    uint8_t id = pgm_read_byte(&lock_parameters[chn][lock]);
+    return (id == NO_PARAMETER) ? NULL : parameter_get(id).target;
+}
+
+bool sequencer_lock_range(uint8_t chn, uint8_t lock, int8_t *min, int8_t *max)
+/* Gives the range of values for a lock, or false if the channel lacks it */
+{
+    if (lock_target(chn, lock) == NULL)
+        return false;
+
+    if (lock == LOCK_VOLUME) {
+        *min = 0;
+        *max = 15;
+    }
+    else {
+        struct parameter p = parameter_get(pgm_read_byte(&lock_parameters[chn][lock]));
+        *min = p.min;
+        *max = p.max;
+    }
+    return true;
+}
+
+static void apply_lock(uint8_t chn)
+{
+    int8_t *target = lock_target(chn, step[chn].lock);
+    if (target == NULL)
+        return;
+
+    int8_t min, max;
+    sequencer_lock_range(chn, step[chn].lock, &min, &max);
+    int8_t value = step[chn].lock_value;
+
+    lock_targets[chn] = target;
+    lock_saved[chn] = *target;
+    *target = (value < min) ? min : (value > max) ? max : value;
+}
+
+static void release_lock(uint8_t chn)
+{
+    if (lock_targets[chn] == NULL)
+        return;
+
+    *lock_targets[chn] = lock_saved[chn];
+    lock_targets[chn] = NULL;
+}
+
+static void note_on(uint8_t chn)
+{
+    apply_lock(chn);
+    play_note(chn, step[chn].note);
+    if (sequencer_midi_out_channels[chn] != 0) {
+        struct midi_message msg = {.command = MIDI_CMD_NOTE_ON,
+                                   .channel = sequencer_midi_out_channels[chn] - 1,
+                                   .data1 = step[chn].note,
+                                   .data2 = 127};
+        midi_io_write_message(msg);
+    }
+}
+
+static void note_off(uint8_t chn, uint8_t note)
+{
+    if (chn <= 3)
+        stop_note(chn);
+    release_lock(chn);
+    if (sequencer_midi_out_channels[chn] != 0) {
+        struct midi_message msg = {.command = MIDI_CMD_NOTE_OFF,
+                                   .channel = sequencer_midi_out_channels[chn] - 1,
+                                   .data1 = note,
+                                   .data2 = 127};
+        midi_io_write_message(msg);
+    }
+}
+
+static inline bool is_due(uint16_t time)
+{
+    return (int16_t)(now - time) >= 0;
+}
+
+static void update_time(void)
+{
+    now = task_time();
+}
+
+static void send_events(void)
+/* Starts and stops the notes that are due */
+{
+    update_time();
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (events[chn].off_pending && is_due(events[chn].off_time)) {
+            events[chn].off_pending = false;
+            note_off(chn, events[chn].off_note);
+        }
+        if (events[chn].on_pending && is_due(events[chn].on_time)) {
+            events[chn].on_pending = false;
+            note_on(chn);
+        }
+    }
+}
+
+static inline uint16_t note_delay(const struct sequencer_note *note)
+{
+    return swing_delay + (uint16_t)(((uint32_t)step_length * note->delay) >> 4);
+}
+
+static void schedule_on(uint8_t chn)
+{
+    uint16_t time = now + note_delay(&step[chn]);
+
+    // The previous note ends no later than this one starts
+    if (events[chn].off_pending && (int16_t)(events[chn].off_time - time) > 0)
+        events[chn].off_time = time;
+
+    events[chn].on_time = time;
+    events[chn].on_pending = true;
+}
+
+static void schedule_off(uint8_t chn)
+{
+    if (events[chn].off_pending)
+        note_off(chn, events[chn].off_note);
+
+    events[chn].off_time = now + note_delay(&step[chn]);
+    events[chn].off_note = step[chn].note;
+    events[chn].off_pending = true;
+}
+
+static void start_step(void)
+/* Works out the timing of the step about to be played */
+{
+    // A note that is still waiting belongs to the previous step
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (events[chn].on_pending) {
+            events[chn].on_pending = false;
+            note_on(chn);
+        }
+    }
+
+    step_time = now;
+    if (sequencer_ext_clock)
+        step_length = STEP_TICKS * (uint16_t)(now - tick_time);
+    else
+        step_length = (uint32_t)STEP_TICKS * TASK_TICK_RATE * 60 * 10 / TASK_TEMPO_PPQN
+            * (1 << playing->scale) / sequencer_tempo;
+
+    swing_delay = 0;
+    if (sequencer_cur_position & 1)
+        swing_delay = (uint32_t)step_length * (playing->swing - SEQUENCER_SWING_MIN) / 50;
+}
 
 void sequencer_setup(void)
 {
     sequencer_ext_clock = settings_read(SEQUENCER_EXT_CLK);
+    task_tempo_set(sequencer_tempo);
+}
+
+void sequencer_tempo_set(uint16_t tempo)
+/* Sets the internal tempo in tenths of BPM */
+{
+    if (tempo < SEQUENCER_TEMPO_MIN)
+        tempo = SEQUENCER_TEMPO_MIN;
+    else if (tempo > SEQUENCER_TEMPO_MAX)
+        tempo = SEQUENCER_TEMPO_MAX;
+
+    sequencer_tempo = tempo;
+    task_tempo_set(tempo);
+}
+
+static inline void send_transport(uint8_t command)
+/* Sends start, stop and continue to follow the internal clock */
+{
+    if (!sequencer_ext_clock)
+        midi_io_write_realtime(command);
+}
+
+static void clock_pulse(void)
+/* Advances the sequencer by one 24 ppqn clock pulse */
+{
+    if (++midi_clock_count == (1 << playing->scale)) {
+        midi_clock_count = 0;
+        tick();
+    }
+}
+
+void sequencer_timing_handler(void)
+{
+    bool running = mode == PLAY || mode == RECORD;
+
+    // Pulses from the internal tempo clock, which is also sent as MIDI
+    // clock when the sequencer isn't following an external one
+    uint8_t pulses = task_tempo_pulses();
+    while (tempo_pulses != pulses) {
+        tempo_pulses++;
+        if (running && !sequencer_ext_clock) {
+            midi_io_write_realtime(MIDI_CMD_CLOCK);
+            clock_pulse();
+        }
+    }
+
+    if (running)
+        send_events();
 }
 
 void sequencer_handler(void)
 {
+    if (mode == PLAY || mode == RECORD) {
+        prefetch();
+        prefetch_step();
+    }
+
     if (mode == SINGLE_NOTE && ++tempo_counter == ENTER_NOTE_COUNT) {
         stop_note(enter_note_chn);
         mode = STOP;
     }
 
-    if (sequencer_ext_clock || (mode != PLAY && mode != RECORD))
-        return;
-
-    if (++tempo_counter == sequencer_tempo_count) {
-        tempo_counter = 0;
-        tick();
-    }
 }
 
 void sequencer_single_note(uint8_t chn)
 {
     enter_note_chn = chn;
+    tempo_counter = 0;
     mode = SINGLE_NOTE;
 }
 
@@ -88,135 +606,351 @@ void sequencer_midi_clock(void)
     if (!sequencer_ext_clock || (mode != PLAY && mode != RECORD))
         return;
 
-    if (++midi_clock_count == (1 << sequencer_pattern.scale)) {
-        midi_clock_count = 0;
-        tick();
-    }
+    clock_pulse();
+}
+
+static void play_edit_buffer(void)
+{
+    playing = &sequencer_pattern;
+    play_address = edit_address();
+    sequencer_cur_position = 0;
+    duration_counter = 0;
+    update_time();
+    tick_time = now;
+    if (!next.queued)
+        next.ready = false;
+
+    // The first step is due right away
+    prefetch_step();
 }
 
 void sequencer_play(void)
 {
     mode = PLAY;
-    sequencer_cur_position = 0;
+    play_edit_buffer();
+    send_transport(MIDI_CMD_START);
 }
 
 void sequencer_record(uint8_t chn)
 {
     mode = RECORD;
     record_chn = chn;
-    sequencer_cur_position = 0;
+    play_edit_buffer();
+    send_transport(MIDI_CMD_START);
     sequencer_midi_note = 0xFF;
+    for (uint8_t i = 0; i < 5; i++)
+        recording[i].held = false;
+}
+
+static int8_t record_channel(uint8_t midi_channel)
+/*
+  Finds the channel to record a note from a MIDI channel on: a free
+  channel set to that MIDI channel, or the selected channel if none are.
+*/
+{
+    bool assigned = false;
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (assigner_midi_channel_get(chn) == midi_channel) {
+            assigned = true;
+            if (!recording[chn].held)
+                return chn;
+        }
+    }
+
+    if (!assigned && !recording[record_chn].held)
+        return record_chn;
+
+    return -1;
+}
+
+void sequencer_record_note(uint8_t midi_channel, uint8_t note, uint16_t received)
+/*
+  Records a note at the step nearest to when it was played. The note is
+  added to what is already in the pattern, and held until it's released.
+*/
+{
+    if (mode != RECORD)
+        return;
+
+    int8_t chn = record_channel(midi_channel);
+    if (chn < 0)
+        return;
+
+    uint8_t pos = sequencer_cur_position;
+    int16_t offset = received - step_time;
+
+    // Notes played before the step started belong to it, since tick()
+    // may have run before the note was read
+    if (offset > 0 && (uint16_t)offset >= step_length / 2) {
+        if (++pos >= sequencer_pattern.end_point)
+            pos = 0;
+    }
+
+    recording[chn].held = true;
+    recording[chn].midi_channel = midi_channel;
+    recording[chn].note = note;
+    recording[chn].pos = pos;
+    recording[chn].time = received;
+
+    struct sequencer_note recorded = {.note = note, .length = STEP_TICKS};
+    sequencer_note_set(chn, pos, &recorded);
+}
+
+void sequencer_record_release(uint8_t midi_channel, uint8_t note, uint16_t received)
+/* Sets the length of a recorded note to how long it was held */
+{
+    if (mode != RECORD)
+        return;
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (!recording[chn].held || recording[chn].midi_channel != midi_channel
+            || recording[chn].note != note)
+            continue;
+
+        recording[chn].held = false;
+
+        uint16_t duration = received - recording[chn].time;
+        uint32_t length = STEP_TICKS;
+        if (step_length > 0)
+            length = ((uint32_t)duration * STEP_TICKS + step_length / 2) / step_length;
+
+        struct sequencer_note recorded = {.note = note};
+        recorded.length = (length < 1) ? 1 : (length > STEP_TICKS) ? STEP_TICKS : length;
+        sequencer_note_set(chn, recording[chn].pos, &recorded);
+        return;
+    }
 }
 
 void sequencer_stop(void)
 {
+    if (mode == PLAY || mode == RECORD)
+        send_transport(MIDI_CMD_STOP);
     mode = STOP;
     tempo_counter = 0;
     duration_counter = 0;
     midi_clock_count = 0;
     for (uint8_t chn = 0; chn < 5; chn++) {
-        const struct sequencer_note* current_note = &sequencer_pattern.notes[chn][sequencer_cur_position];
-        if (current_note->length > 0)
+        recording[chn].held = false;
+        events[chn].on_pending = false;
+        if (events[chn].off_pending) {
+            events[chn].off_pending = false;
+            note_off(chn, events[chn].off_note);
+        }
+        if (step[chn].length > 0)
             stop_note(chn);
+        release_lock(chn);
+    }
+
+    // A pattern waiting for the end point is switched to right away
+    if (next.queued) {
+        next.queued = false;
+        sequencer_pattern_load(next.pattern);
     }
 }
 
 void sequencer_continue(void)
 {
     mode = PLAY;
+    update_time();
+    tick_time = now;
+    prefetch_step();
+    send_transport(MIDI_CMD_CONTINUE);
+}
+
+void sequencer_song_position(uint16_t position)
+/*
+  Moves to a Song Position Pointer position, given in 16th notes from the
+  start of the song, while following an external clock and stopped. The
+  position is counted from the start of the pattern being edited, and
+  wraps at its end point.
+*/
+{
+    if (!sequencer_ext_clock || mode == PLAY || mode == RECORD)
+        return;
+
+    uint32_t pulses = (uint32_t)position * 6;
+    uint32_t ticks = pulses >> sequencer_pattern.scale;
+
+    playing = &sequencer_pattern;
+    play_address = edit_address();
+    midi_clock_count = pulses & ((1 << sequencer_pattern.scale) - 1);
+    duration_counter = ticks % STEP_TICKS;
+    sequencer_cur_position = (ticks / STEP_TICKS) % sequencer_pattern.end_point;
+
+    // Notes of a step that has been started are ended as usual
+    if (duration_counter != 0)
+        read_step(play_address, sequencer_cur_position, step);
 }
 
 void sequencer_pattern_load(uint8_t pattern)
+/* Copies a stored pattern to the edit buffer */
 {
-    memory_set_address(&ctx, SEQUENCER_START + PATTERN_SIZE * pattern);
-    for (uint8_t chn = 0; chn < 5; chn++) {
-        for (uint8_t i = 0; i < 16; i++) {
-            sequencer_pattern.notes[chn][i].note = memory_read_sequential(&ctx);
-            sequencer_pattern.notes[chn][i].length = memory_read_sequential(&ctx);
-        }
-    }
-    sequencer_pattern.scale = memory_read_sequential(&ctx);
-    sequencer_pattern.end_point = memory_read_sequential(&ctx);
+    integrity_require(INTEGRITY_PATTERN(pattern));
+    copy_pattern(edit_address(), pattern_address(pattern));
+    read_header(edit_address(), &sequencer_pattern);
+    sequencer_loaded_pattern = pattern;
+    upcoming_ready = false;
 }
 
 void sequencer_pattern_save(uint8_t pattern)
 {
-    memory_set_address(&ctx, SEQUENCER_START + PATTERN_SIZE * pattern);
-    for (uint8_t chn = 0; chn < 5; chn++) {
-        for (uint8_t i = 0; i < 16; i++) {
-            memory_write_sequential(&ctx, sequencer_pattern.notes[chn][i].note);
-            memory_write_sequential(&ctx, sequencer_pattern.notes[chn][i].length);
-        }
-    }
-    memory_write_sequential(&ctx, sequencer_pattern.scale);
-    memory_write_sequential(&ctx, sequencer_pattern.end_point);
+    integrity_touch(INTEGRITY_PATTERN(pattern));
+    write_header(edit_address(), &sequencer_pattern);
+    copy_pattern(pattern_address(pattern), edit_address());
+}
+
+void sequencer_note_get(uint8_t chn, uint8_t pos, struct sequencer_note *note)
+/* Reads a note from the edit buffer */
+{
+    uint8_t data[NOTE_SIZE];
+    memory_read_burst(note_address(edit_address(), pos, chn), data, NOTE_SIZE);
+    decode_note(data, note);
+}
+
+void sequencer_note_set(uint8_t chn, uint8_t pos, const struct sequencer_note *note)
+/* Writes a note to the edit buffer */
+{
+    uint8_t data[NOTE_SIZE];
+    encode_note(note, data);
+    memory_write_burst(note_address(edit_address(), pos, chn), data, NOTE_SIZE);
+
+    // An edit of the step read ahead is heard when it is played
+    if (upcoming_ready && upcoming_address == edit_address() && upcoming_pos == pos)
+        upcoming[chn] = *note;
 }
 
 void sequencer_clear_sequence(void)
 {
-    for (uint8_t chn = 0; chn < 5; chn++) {
-        for (uint8_t i = 0; i < 16; i++) {
-            sequencer_pattern.notes[chn][i].note = 0;
-            sequencer_pattern.notes[chn][i].length = 0;
-        }
-    }
+    clear_steps(edit_address());
+    upcoming_ready = false;
+}
+
+void sequencer_pattern_clear(uint8_t pattern)
+/* Resets a stored pattern to an empty one */
+{
+    if (pattern < PATTERN_EDIT_BUFFER)
+        integrity_touch(INTEGRITY_PATTERN(pattern));
+    write_header(pattern_address(pattern), &empty_pattern);
+    clear_steps(pattern_address(pattern));
+    upcoming_ready = false;
 }
 
 void sequencer_pattern_init(void)
 {
-    memory_set_address(&ctx, SEQUENCER_START);
+    for (uint8_t pat = 0; pat < PATTERN_EDIT_BUFFER + NUM_EDIT_BUFFERS; pat++)
+        sequencer_pattern_clear(pat);
+    sequencer_pattern = empty_pattern;
+}
+
+void sequencer_pattern_migrate(void)
+/*
+  Moves the patterns saved by the first firmware into the pattern area
+  at the top of memory, overwriting any sample data there. The steps
+  past the first 16 are left empty.
+*/
+{
+    sequencer_pattern_init();
+
     for (uint8_t pat = 0; pat < 100; pat++) {
+        uint32_t old_address = OLD_PATTERN_START + (uint32_t)OLD_PATTERN_SIZE * pat;
+        uint32_t address = pattern_address(pat);
+
+        integrity_touch(INTEGRITY_PATTERN(pat));
+
         for (uint8_t chn = 0; chn < 5; chn++) {
-            for (uint8_t i = 0; i < 16; i++) {
-                memory_write_sequential(&ctx, 0);
-                memory_write_sequential(&ctx, 0);
+            for (uint8_t pos = 0; pos < 16; pos++) {
+                struct sequencer_note note = {
+                    .note = memory_read(old_address++),
+                    .length = memory_read(old_address++)
+                };
+                uint8_t data[NOTE_SIZE];
+                encode_note(&note, data);
+                memory_write_burst(note_address(address, pos, chn), data, NOTE_SIZE);
             }
         }
-        memory_write_sequential(&ctx, 2); // scale
-        memory_write_sequential(&ctx, 16); // end point
+
+        struct sequencer_pattern header = {.chain = SEQUENCER_NO_CHAIN};
+        header.scale = memory_read(old_address++);
+        header.end_point = memory_read(old_address);
+        write_header(address, &header);
+    }
+}
+
+static void pattern_end(void)
+/*
+  Continues with the queued or chained pattern when the end point is
+  reached, using what was prefetched. A pattern whose header and first
+  step aren't ready yet is switched to at a later end point, and the
+  playing pattern is repeated until then.
+*/
+{
+    if (mode != PLAY || !next.ready)
+        return;
+
+    if (!upcoming_ready || upcoming_address != next.address || upcoming_pos != 0)
+        return;
+
+    if (next.queued) {
+        edit_buffer ^= 1;
+        sequencer_pattern = next.header;
+        sequencer_loaded_pattern = next.pattern;
+        playing = &sequencer_pattern;
     }
+    else {
+        chained = next.header;
+        playing = &chained;
+    }
+    play_address = next.address;
+
+    next.queued = false;
+    next.ready = false;
+}
+
+static void take_step(void)
+/* Starts playing the step read ahead, or a rest if it isn't ready */
+{
+    if (upcoming_ready && upcoming_address == play_address && upcoming_pos == sequencer_cur_position) {
+        for (uint8_t chn = 0; chn < 5; chn++)
+            step[chn] = upcoming[chn];
+    }
+    else {
+        for (uint8_t chn = 0; chn < 5; chn++)
+            step[chn].length = 0;
+        sequencer_step_misses++;
+    }
+    upcoming_ready = false;
 }
 
 void tick(void)
 {
-    for (uint8_t chn = 0; chn < 5; chn++) {
-        struct sequencer_note* current_note = &sequencer_pattern.notes[chn][sequencer_cur_position];
+    update_time();
 
-        if (mode == RECORD && record_chn == chn && sequencer_midi_note != 0xFF) {
-            current_note->note = sequencer_midi_note;
-            current_note->length = 4; // actually time this
-            sequencer_midi_note = 0xFF;
-        }
+    if (duration_counter == 0) {
+        start_step();
+        take_step();
+    }
+    tick_time = now;
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        struct sequencer_note* current_note = &step[chn];
 
         if (duration_counter == 0) {
-            if (current_note->length > 0) {
-                play_note(chn, current_note->note);
-                if (sequencer_midi_out_channels[chn] != 0) {
-                    struct midi_message msg = {.command = MIDI_CMD_NOTE_ON,
-                                               .channel = sequencer_midi_out_channels[chn] - 1,
-                                               .data1 = current_note->note,
-                                               .data2 = 127};
-                    midi_io_write_message(msg);
-                }
-            }
+            if (current_note->length > 0 && !(mode == RECORD && recording[chn].held))
+                schedule_on(chn);
         }
-        else if (current_note->length == duration_counter) {
-            if (chn <= 3)
-                stop_note(chn);
-            if (sequencer_midi_out_channels[chn] != 0) {
-                struct midi_message msg = {.command = MIDI_CMD_NOTE_OFF,
-                                           .channel = sequencer_midi_out_channels[chn] - 1,
-                                           .data1 = current_note->note,
-                                           .data2 = 127};
-                midi_io_write_message(msg);
-            }
-        }
-
+        else if (current_note->length == duration_counter)
+            schedule_off(chn);
     }
 
-    if (++duration_counter == 6) {
+    // Notes without a delay are sent right away
+    send_events();
+
+    if (++duration_counter == STEP_TICKS) {
         duration_counter = 0;
-        if (++sequencer_cur_position == sequencer_pattern.end_point)
+        if (++sequencer_cur_position >= playing->end_point) {
             sequencer_cur_position = 0;
+            pattern_end();
+        }
     }
 }
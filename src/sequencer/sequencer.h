@@ -18,40 +18,92 @@
 
 
 
+
   Sequencer
 
+  Patterns are kept in SRAM and streamed one step at a time while
+  playing. Only the pattern header and the current step are held in RAM.
 */
 
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SEQUENCER_MAX_STEPS 64
+#define SEQUENCER_NUM_PATTERNS 100
+#define SEQUENCER_PATTERN_SIZE 1024
+#define SEQUENCER_NO_CHAIN -1
+
+// Swing in percent: how far into a pair of steps the second one starts
+#define SEQUENCER_SWING_MIN 50
+#define SEQUENCER_SWING_MAX 75
+
+// Internal tempo range, in tenths of BPM
+#define SEQUENCER_TEMPO_MIN 300
+#define SEQUENCER_TEMPO_MAX 1999
+#define SEQUENCER_TEMPO_DEFAULT 1200
+
+// Largest step delay, in sixteenths of a step
+#define SEQUENCER_MAX_DELAY 7
+
+// Parameters that can be locked to a value for a single step
+enum sequencer_lock {
+    LOCK_NONE,
+    LOCK_DUTY,
+    LOCK_VOLUME,
+    LOCK_LFO1,
+    LOCK_LFO2,
+    LOCK_LFO3,
+    NUM_LOCKS
+};
+
 struct sequencer_note {
     uint8_t note;
-    uint8_t length;
+    uint8_t length;       // In sixths of a step, 0 when there is no note
+    uint8_t lock;
+    int8_t lock_value;
+    uint8_t delay;        // Started late by this many sixteenths of a step
 };
 
 struct sequencer_pattern {
     int8_t scale;
-    int8_t end_point;
-
-    struct sequencer_note notes[5][16];
+    int8_t end_point;     // Number of steps
+    int8_t chain;         // Pattern to continue with, or SEQUENCER_NO_CHAIN
+    int8_t swing;
 };
 
 extern struct sequencer_pattern sequencer_pattern;
 extern uint8_t sequencer_cur_position;
-extern uint8_t sequencer_tempo_count;
+extern uint16_t sequencer_tempo;
 extern int8_t sequencer_ext_clock;
 extern uint8_t sequencer_midi_note;
 extern int8_t sequencer_midi_out_channels[5];
+extern uint8_t sequencer_loaded_pattern;
+
+// Steps played as rests since they hadn't been read ahead in time
+extern uint16_t sequencer_step_misses;
 
 void sequencer_setup(void);
 void sequencer_handler(void);
+void sequencer_timing_handler(void);
 void sequencer_midi_clock(void);
+void sequencer_tempo_set(uint16_t tempo);
 void sequencer_pattern_load(uint8_t pattern);
 void sequencer_pattern_save(uint8_t pattern);
+void sequencer_pattern_queue(uint8_t pattern);
 void sequencer_play(void);
 void sequencer_record(uint8_t chn);
+void sequencer_record_note(uint8_t midi_channel, uint8_t note, uint16_t received);
+void sequencer_record_release(uint8_t midi_channel, uint8_t note, uint16_t received);
 void sequencer_stop(void);
 void sequencer_continue(void);
+void sequencer_song_position(uint16_t position);
 void sequencer_single_note(uint8_t chn);
 void sequencer_pattern_init(void);
+void sequencer_pattern_clear(uint8_t pattern);
+void sequencer_pattern_migrate(void);
 void sequencer_clear_sequence(void);
+void sequencer_note_get(uint8_t chn, uint8_t step, struct sequencer_note *note);
+void sequencer_note_set(uint8_t chn, uint8_t step, const struct sequencer_note *note);
+bool sequencer_lock_range(uint8_t chn, uint8_t lock, int8_t *min, int8_t *max);
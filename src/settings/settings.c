@@ -1,23 +1,33 @@
 #include <stdint.h>
 #include "io/memory.h"
 #include "settings.h"
-
-#define SETTINGS_BASE_ADDRESS 0x80
-#define SETTINGS_SIZE (SEQUENCER_EXT_CLK - MIDI_CHN + 1)
+#include "integrity/integrity.h"
 
 int8_t settings_read(enum settings_id id)
 {
+    integrity_require(INTEGRITY_SETTINGS);
     return memory_read(SETTINGS_BASE_ADDRESS + id);
 }
 
 void settings_write(enum settings_id id, int8_t value)
 {
+    integrity_touch(INTEGRITY_SETTINGS);
     memory_write(SETTINGS_BASE_ADDRESS + id, value);
 }
 
 void settings_init(void)
 {
+    integrity_touch(INTEGRITY_SETTINGS);
     for (uint8_t i = 0; i < SETTINGS_SIZE; i++) {
         memory_write(SETTINGS_BASE_ADDRESS + i, 0);
     }
 }
+
+void settings_migrate(void)
+/* Initializes the settings added since the first firmware, which left them unwritten */
+{
+    integrity_touch(INTEGRITY_SETTINGS);
+    for (uint8_t i = TUNING_A4_LOW; i < SETTINGS_SIZE; i++) {
+        memory_write(SETTINGS_BASE_ADDRESS + i, 0);
+    }
+}
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#define TUNING_MAP_SIZE 12
+
 enum settings_id {
     MIDI_CHN = 0,
     PROGRAMMER_SELECTED_PATCH = 5,
@@ -9,9 +11,21 @@ enum settings_id {
     ASSIGNER_LOWER_MODE,
     ASSIGNER_SPLIT,
     SEQUENCER_SELECTED_SEQ,
-    SEQUENCER_EXT_CLK
+    SEQUENCER_EXT_CLK,
+    // Added since the first firmware, and set to 0 by settings_migrate
+    TUNING_A4_LOW,       // A4 reference in 1/10 Hz, 0 means 440 Hz
+    TUNING_A4_HIGH,
+    TUNING_MAP,          // 12 entries, deviation in cents per scale degree
+    GLIDE_LEGATO = TUNING_MAP + TUNING_MAP_SIZE,
+    MACRO_RATE,          // Macro frame rate in Hz, 0 means the default
+    ASSIGNER_POLICY,
+    MPE_MEMBERS          // Member channels in the MPE zone, 0 means MPE off
 };
 
+#define SETTINGS_BASE_ADDRESS 0x80
+#define SETTINGS_SIZE (MPE_MEMBERS - MIDI_CHN + 1)
+
 int8_t settings_read(enum settings_id id);
 void settings_write(enum settings_id id, int8_t value);
 void settings_init(void);
+void settings_migrate(void);
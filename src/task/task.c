@@ -26,6 +26,8 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include "task.h"
 #include "apu/apu.h"
 #include "io/midi.h"
@@ -33,6 +35,7 @@
 #include "envelope/envelope.h"
 #include "modulation/modulation.h"
 #include "portamento/portamento.h"
+#include "macro/macro.h"
 #include "midi/midi.h"
 #include "io/leds.h"
 #include "io/input.h"
@@ -40,21 +43,32 @@
 #include "ui/ui_sequencer.h"
 #include "assigner/assigner.h"
 #include "sequencer/sequencer.h"
+#include "patch/patch.h"
+#include "patch/morph.h"
+#include "integrity/integrity.h"
 
+/*
+  The task table is kept in flash. Only the counters, which start at the
+  count given in the table, are kept in RAM.
+*/
 struct task {
-    void (*const handler)(void);
-    const uint8_t period;
+    void (*handler)(void);
+    uint8_t period;
     uint8_t counter;
 };
 
-struct task tasks[] = {
-    {.handler = &apu_dmc_update_handler, .period = 1, .counter = 1},
+static const struct task tasks[] PROGMEM = {
+    {.handler = &task_yield, .period = 1, .counter = 1},
     {.handler = &lfo_update_handler, .period = 1, .counter = 1},
     {.handler = &midi_io_handler, .period = 5, .counter = 0},
+    {.handler = &sequencer_timing_handler, .period = 5, .counter = 2},
     {.handler = &apu_update_handler, .period = 10, .counter = 1},
     {.handler = &envelope_update_handler, .period = 10, .counter = 3},
     {.handler = &portamento_handler, .period = 10, .counter = 4},
+    {.handler = &macro_handler, .period = 10, .counter = 2},
     {.handler = &midi_handler, .period = 10, .counter = 5},
+    {.handler = &patch_commit_handler, .period = 10, .counter = 5},
+    {.handler = &morph_handler, .period = 10, .counter = 5},
     {.handler = &mod_calculate, .period = 10, .counter = 6},
     {.handler = &mod_apply, .period = 10, .counter = 7},
     {.handler = &sequencer_handler, .period = 20, .counter = 5},
@@ -62,14 +76,34 @@ struct task tasks[] = {
     {.handler = &input_refresh, .period = 80, .counter = 8},
     {.handler = &ui_handler, .period = 80, .counter = 9},
     {.handler = &ui_leds_handler, .period = 80, .counter = 9},
+    {.handler = &integrity_handler, .period = 80, .counter = 40},
 };
 
-static const uint8_t num_tasks = sizeof(tasks)/sizeof(struct task);
+#define NUM_TASKS (sizeof(tasks)/sizeof(struct task))
+
+static uint8_t counters[NUM_TASKS];
 
 static volatile uint8_t ticks;
+static volatile uint16_t long_ticks;
+
+/*
+  Tempo clock. The rate, in tenths of BPM, is added to a phase
+  accumulator on every tick, and a pulse is counted each time the phase
+  passes a minute's worth of ticks divided by the pulses per beat and the
+  tenths. This gives the exact average pulse rate at any tempo, with at
+  most one tick of jitter.
+*/
+#define TEMPO_PHASE_WRAP ((uint32_t)TASK_TICK_RATE * 60 * 10 / TASK_TEMPO_PPQN)
+
+static uint32_t tempo_phase;
+static uint16_t tempo_rate;
+static volatile uint8_t tempo_pulses;
 
 void task_setup(void)
 {
+    for (uint8_t i = 0; i < NUM_TASKS; i++)
+        counters[i] = pgm_read_byte(&tasks[i].counter);
+
     /*
        Sets up the timing interrupt to occur at 16 kHz
     */
@@ -89,6 +123,49 @@ void task_setup(void)
     TCCR0B = (1 << FOC0A) | (0b010 << CS00);
 }
 
+uint16_t task_time(void)
+/*
+  Returns the free running 16 kHz tick count in 16 bits, for spans of
+  up to four seconds
+*/
+{
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = long_ticks;
+    }
+    return t;
+}
+
+void task_tempo_set(uint16_t bpm)
+/* Sets the tempo clock rate in tenths of BPM */
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tempo_rate = bpm;
+    }
+}
+
+uint8_t task_tempo_pulses(void)
+/* Returns the free running count of tempo clock pulses */
+{
+    return tempo_pulses;
+}
+
+void task_yield(void)
+/*
+  Runs the DMC sample update, unless it has already run in this tick.
+  This is the DMC's task, and is also called from inside long bus
+  transactions so that samples keep playing while they run.
+*/
+{
+    static uint8_t dmc_tick;
+
+    if (ticks == dmc_tick)
+        return;
+
+    dmc_tick = ticks;
+    apu_dmc_update_handler();
+}
+
 void task_stop(void)
 {
     TIMSK0 = 0;
@@ -105,6 +182,13 @@ ISR(TIMER0_COMPA_vect)
 */
 {
     ticks++;
+    long_ticks++;
+
+    tempo_phase += tempo_rate;
+    if (tempo_phase >= TEMPO_PHASE_WRAP) {
+        tempo_phase -= TEMPO_PHASE_WRAP;
+        tempo_pulses++;
+    }
 }
 
 void task_manager(void)
@@ -116,20 +200,21 @@ void task_manager(void)
         while (ticks == last_tick);
 
         // Loop through each task and update its count
-        for (uint8_t i = 0; i < num_tasks; i++)
-            tasks[i].counter += ticks - last_tick;
+        for (uint8_t i = 0; i < NUM_TASKS; i++)
+            counters[i] += ticks - last_tick;
 
         last_tick = ticks;
 
-        for (uint8_t i = 0; i < num_tasks; i++) {
+        for (uint8_t i = 0; i < NUM_TASKS; i++) {
             // If number of ticks changed after previous task, stop going further
             if (ticks != last_tick)
                 break;
 
             // Call the task/task.handler when the count reaches the period
-            if (tasks[i].counter >= tasks[i].period) {
-                tasks[i].counter = 0;
-                tasks[i].handler();
+            if (counters[i] >= pgm_read_byte(&tasks[i].period)) {
+                counters[i] = 0;
+                void (*handler)(void) = pgm_read_ptr(&tasks[i].handler);
+                handler();
             }
         }
     }
@@ -27,5 +27,17 @@
 
 #pragma once
 
+#include <stdint.h>
+
+// Rate of the timer interrupt, in Hz
+#define TASK_TICK_RATE 16025
+
+// Tempo clock pulses per beat, as in MIDI clock
+#define TASK_TEMPO_PPQN 24
+
 void task_manager(void);
 void task_setup(void);
+uint16_t task_time(void);
+void task_yield(void);
+void task_tempo_set(uint16_t bpm);
+uint8_t task_tempo_pulses(void);
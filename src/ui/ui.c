@@ -41,12 +41,26 @@
 #include "assigner/assigner.h"
 
 #include <stdbool.h>
+#include <avr/pgmspace.h>
 
 #define BLINK_CNT 30
 
 enum mode mode = MODE_SILENCE;
 
-uint8_t prev_input[3] = {0};
+/*
+  The mode handlers are given one button event per call. The button
+  pressed last gives a hold event once it has been held for a while,
+  followed by repeat events for as long as it is held. These are timed
+  from the time stamp of the press, in input_refresh calls.
+*/
+#define HOLD_TIME 60
+#define REPEAT_TIME 11
+
+struct input_event ui_event = {.button = INPUT_NO_BUTTON, .type = INPUT_NONE};
+
+static uint8_t held_button = INPUT_NO_BUTTON;
+static uint16_t held_since;
+static uint16_t next_hold;
 
 /* Pointer to array holding LED states for chosen mode */
 uint8_t* button_leds = programmer_leds;
@@ -70,7 +84,7 @@ static void silence_channels(void);
 static void show_transfer(void);
 static void error_handler(void);
 
-struct mode_data modes[] = {
+static const struct mode_data modes[] PROGMEM = {
     [MODE_PAGE1] = {.button = BTN_PAGE1,
                     .leds = programmer_leds,
                     .handler = programmer},
@@ -124,22 +138,52 @@ static inline uint8_t mode_stack_pop(void)
 void ui_push_mode(uint8_t m)
 {
     mode_stack_push(mode);
-    if (!modes[m].leds) {
+    button_leds = pgm_read_ptr_near(&modes[m].leds);
+    if (!button_leds) {
         for (uint8_t i = 0; i < 24; i++) {
             leds_off(i);
         }
     }
-    button_leds = modes[m].leds;
     mode = m;
 }
 
 void ui_pop_mode()
 {
     uint8_t m = mode_stack_pop();
-    button_leds = modes[m].leds;
+    button_leds = pgm_read_ptr_near(&modes[m].leds);
     mode = m;
 }
 
+static void next_event(void)
+/*
+  Takes the next event to be handled: the oldest queued one, or else a
+  hold or repeat that is due
+*/
+{
+    if (input_event_read(&ui_event)) {
+        if (ui_event.type == INPUT_PRESS) {
+            held_button = ui_event.button;
+            held_since = ui_event.time;
+            next_hold = HOLD_TIME;
+        }
+        else if (ui_event.button == held_button) {
+            held_button = INPUT_NO_BUTTON;
+        }
+        return;
+    }
+
+    if (held_button != INPUT_NO_BUTTON && (uint16_t)(input_time() - held_since) >= next_hold) {
+        ui_event.button = held_button;
+        ui_event.type = (next_hold == HOLD_TIME) ? INPUT_HOLD : INPUT_REPEAT;
+        ui_event.time = held_since + next_hold;
+        next_hold += REPEAT_TIME;
+        return;
+    }
+
+    ui_event.button = INPUT_NO_BUTTON;
+    ui_event.type = INPUT_NONE;
+}
+
 void ui_handler(void)
 /*
   Top level user interface handler. Checks whether one of the
@@ -147,23 +191,21 @@ void ui_handler(void)
   the corresponding function.
 */
 {
+    next_event();
+
     if (mode <= MODE_SETTINGS) {
         button_led_on(BTN_PAGE1 + mode);
         for (enum mode m = MODE_PAGE1; m <= MODE_SETTINGS; m++) {
-            if (button_pressed(modes[m].button)) {
-                button_led_off(modes[mode].button);
+            if (button_pressed(pgm_read_byte(&modes[m].button))) {
+                button_led_off(pgm_read_byte(&modes[mode].button));
                 mode = m;
-                button_leds = modes[m].leds;
+                button_leds = pgm_read_ptr_near(&modes[m].leds);
             }
         }
     }
 
-    modes[mode].handler();
-
-    // Save current button states
-    prev_input[0] = input[0];
-    prev_input[1] = input[1];
-    prev_input[2] = input[2];
+    void (*handler)(void) = pgm_read_ptr_near(&modes[mode].handler);
+    handler();
 }
 
 
@@ -208,44 +250,20 @@ void ui_leds_handler(void)
    Functions used by the user interface handlers
 */
 
-#define WAIT_CNT 60
-#define SPEED_CNT 10
-
 uint8_t ui_updown(int8_t* value, int8_t min, int8_t max)
-/* Handles up/down buttons when selecting values */
+/* Handles up/down buttons when selecting values. Holding a button
+   repeats it. */
 {
-    static uint8_t wait_count = 0;
-    static uint8_t speed_count = 0;
-
-    if ((button_on(BTN_UP) && *value < max) || (button_on(BTN_DOWN) && *value > min)) {
-        // If the button was just pressed, increase/decrease one step and start the wait counter
-        // (to avoid the value rapidly changing if the button is held for too long)
-        if (button_pressed(BTN_UP)) {
-            (*value)++;
-            wait_count = 0;
-            return 1;
-        }
-
-        else if (button_pressed(BTN_DOWN)) {
-            (*value)--;
-            wait_count = 0;
-            return 1;
-        }
+    if ((button_pressed(BTN_UP) || button_repeated(BTN_UP)) && *value < max) {
+        (*value)++;
+        return 1;
+    }
 
-        // If the button was not just pressed, increase the wait counter and see if
-        // we can start to increase the value continuously
-        else {
-            if (wait_count == WAIT_CNT) {
-                if (speed_count++ == SPEED_CNT) {
-                    speed_count = 0;
-                    *value = (button_on(BTN_UP)) ? *value + 1 : *value - 1;
-                    return 1;
-                }
-            }
-            else
-                wait_count++;
-        }
+    if ((button_pressed(BTN_DOWN) || button_repeated(BTN_DOWN)) && *value > min) {
+        (*value)--;
+        return 1;
     }
+
     return 0;
 }
 
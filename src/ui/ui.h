@@ -53,11 +53,18 @@
 #define button_on_array(ARRAY, BTN) ((ARRAY[button_row(BTN)] & (1 << button_col(BTN))) != 0)
 #define button_on(BTN) (button_on_array(input, BTN))
 
+// Is the event being handled of the given kind for the button?
+#define button_event(BTN, TYPE) (ui_event.button == (BTN) && ui_event.type == (TYPE))
+
 // Was it just pressed?
-#define button_pressed(BTN) (button_on_array(input, BTN) && (!button_on_array(prev_input, BTN)))
+#define button_pressed(BTN) button_event(BTN, INPUT_PRESS)
 
 // Was it just depressed?
-#define button_depressed(BTN) (!button_on_array(input, BTN) && button_on_array(prev_input, BTN))
+#define button_depressed(BTN) button_event(BTN, INPUT_RELEASE)
+
+// Has it just been held down for a while, or is it repeating?
+#define button_held(BTN) button_event(BTN, INPUT_HOLD)
+#define button_repeated(BTN) button_event(BTN, INPUT_REPEAT)
 
 // Gets the boolean value of a particular button
 #define button_getbool(BTN) ((input[button_row(BTN)] >> button_col(BTN)) & 1)
@@ -107,8 +114,8 @@ struct getvalue_config {
     uint8_t midi_note;
 };
 
-// Previous inputs
-extern uint8_t prev_input[3];
+// The button event being handled, of type INPUT_NONE if there is none
+extern struct input_event ui_event;
 extern uint8_t* button_leds;
 
 extern struct getvalue_config getvalue;
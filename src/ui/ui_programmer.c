@@ -31,10 +31,15 @@
 #include "apu/apu.h"
 #include "assigner/assigner.h"
 #include "settings/settings.h"
+#include "portamento/portamento.h"
 
 // Page 2
+#define BTN_STEAL_OLDEST 5
+#define BTN_STEAL_QUIETEST 6
+#define BTN_ROUND_ROBIN 7
 #define BTN_SPLIT 9
 #define BTN_SET_SPLIT 10
+#define BTN_LEGATO 11
 
 #define BTN_LOWER_POLY 12
 #define BTN_LOWER_MONO 13
@@ -204,7 +209,7 @@ struct main_button {
     enum parameter_id depress_parameter;
 };
 
-struct main_button p1_main_buttons[] = {
+static const struct main_button p1_main_buttons[] PROGMEM = {
     {sq1_parameters, SQ1_ENABLED},
     {sq2_parameters, SQ2_ENABLED},
     {tri_parameters, TRI_ENABLED},
@@ -215,7 +220,7 @@ struct main_button p1_main_buttons[] = {
     {lfo3_parameters, LFO3_PERIOD}
 };
 
-struct main_button p2_main_buttons[] = {
+static const struct main_button p2_main_buttons[] PROGMEM = {
     {p2_sq1_parameters, SQ1_ENABLED},
     {p2_sq2_parameters, SQ2_ENABLED},
     {p2_tri_parameters, TRI_ENABLED},
@@ -234,12 +239,30 @@ struct main_button p2_main_buttons[] = {
     {0, 0xFF}
 };
 
-static struct main_button* main_buttons;
+static const struct main_button* main_buttons;
 static uint8_t main_buttons_length;
 static uint8_t param_length;
 
 static inline void toplevel_handler(void);
 
+static inline void mono_led(uint8_t btn, enum assigner_mode m)
+/* Lights a MONO button for mono, and blinks it for unison */
+{
+    if (m == UNISON) {
+        // Only start blinking once, to not disturb the blink phase
+        if (button_led_get(btn) != 0b10) {
+            button_led_off(btn);
+            button_led_blink(btn);
+        }
+    }
+    else if (m == MONO) {
+        button_led_off(btn);
+        button_led_on(btn);
+    }
+    else
+        button_led_off(btn);
+}
+
 void ui_programmer_setup(void)
 {
     patchno = settings_read(PROGRAMMER_SELECTED_PATCH);
@@ -285,16 +308,22 @@ void programmer(void)
         assigner_enabled[chn] ? button_led_on(chn) : button_led_off(chn);
 
     // In page 2 we also want to indicate the assigner mode
-    mode == MODE_PAGE2 && assigner_lower_mode == MONO ?
-        button_led_on(BTN_LOWER_MONO) : button_led_off(BTN_LOWER_MONO);
+    mono_led(BTN_LOWER_MONO, mode == MODE_PAGE2 ? assigner_lower_mode : POLY);
     mode == MODE_PAGE2 && assigner_lower_mode == POLY ?
         button_led_on(BTN_LOWER_POLY) : button_led_off(BTN_LOWER_POLY);
-    mode == MODE_PAGE2 && assigner_upper_mode == MONO ?
-        button_led_on(BTN_UPPER_MONO) : button_led_off(BTN_UPPER_MONO);
+    mono_led(BTN_UPPER_MONO, mode == MODE_PAGE2 ? assigner_upper_mode : POLY);
     mode == MODE_PAGE2 && assigner_upper_mode == POLY ?
         button_led_on(BTN_UPPER_POLY) : button_led_off(BTN_UPPER_POLY);
     mode == MODE_PAGE2 && assigner_split ?
         button_led_on(BTN_SPLIT) : button_led_off(BTN_SPLIT);
+    mode == MODE_PAGE2 && portamento_legato ?
+        button_led_on(BTN_LEGATO) : button_led_off(BTN_LEGATO);
+    mode == MODE_PAGE2 && assigner_policy == STEAL_OLDEST ?
+        button_led_on(BTN_STEAL_OLDEST) : button_led_off(BTN_STEAL_OLDEST);
+    mode == MODE_PAGE2 && assigner_policy == STEAL_QUIETEST ?
+        button_led_on(BTN_STEAL_QUIETEST) : button_led_off(BTN_STEAL_QUIETEST);
+    mode == MODE_PAGE2 && assigner_policy == ROUND_ROBIN ?
+        button_led_on(BTN_ROUND_ROBIN) : button_led_off(BTN_ROUND_ROBIN);
 
     if (mode == MODE_PAGE1) {
         main_buttons = p1_main_buttons;
@@ -310,12 +339,18 @@ void programmer(void)
     toplevel_handler();
 }
 
+static inline const enum parameter_id* get_parameter_list(uint8_t main_button)
+{
+    return pgm_read_ptr_near(&main_buttons[main_button].parameter_list);
+}
+
 static inline enum parameter_id get_parameter_id(uint8_t main_button, uint8_t parameter_button)
 {
-    if (main_buttons[main_button].parameter_list == 0)
+    const enum parameter_id* parameter_list = get_parameter_list(main_button);
+    if (parameter_list == 0)
         return 0xFF;
     uint8_t parameter_num = parameter_button - 5;
-    return pgm_read_byte(&main_buttons[main_button].parameter_list[parameter_num]);
+    return pgm_read_byte(&parameter_list[parameter_num]);
 }
 
 static inline void init_getvalue(uint8_t button1, uint8_t button2,
@@ -343,7 +378,7 @@ static inline void toplevel_handler(void)
     for (uint8_t i = 0; i < main_buttons_length; i++) {
 
         // Handle the case where the main button is currently being pressed
-        if (button_on(i) && main_buttons[i].parameter_list != 0) {
+        if (button_on(i) && get_parameter_list(i) != 0) {
             if (parameter_button < 5 + param_length) {
                 enum parameter_id id = get_parameter_id(i, parameter_button);
 
@@ -357,8 +392,8 @@ static inline void toplevel_handler(void)
         }
 
         // In the case where the main button has been depressed
-        else if (button_depressed(i) && main_buttons[i].depress_parameter != 0xFF) {
-            struct parameter parameter = parameter_get(main_buttons[i].depress_parameter);
+        else if (button_depressed(i) && pgm_read_byte(&main_buttons[i].depress_parameter) != 0xFF) {
+            struct parameter parameter = parameter_get(pgm_read_byte(&main_buttons[i].depress_parameter));
 
             if (parameter.type == BOOL)
                 *parameter.target ^= 1;
@@ -376,21 +411,46 @@ static inline void toplevel_handler(void)
             settings_write(ASSIGNER_LOWER_MODE, POLY);
         }
         if (button_pressed(BTN_LOWER_MONO)) {
-            assigner_lower_mode = MONO;
-            settings_write(ASSIGNER_LOWER_MODE, MONO);
+            // Pressing MONO again switches between mono and unison
+            assigner_lower_mode = (assigner_lower_mode == MONO) ? UNISON : MONO;
+            settings_write(ASSIGNER_LOWER_MODE, assigner_lower_mode);
         }
         if (button_pressed(BTN_UPPER_POLY)) {
             assigner_upper_mode = POLY;
             settings_write(ASSIGNER_UPPER_MODE, POLY);
         }
         if (button_pressed(BTN_UPPER_MONO)) {
-            assigner_upper_mode = MONO;
-            settings_write(ASSIGNER_UPPER_MODE, MONO);
+            assigner_upper_mode = (assigner_upper_mode == MONO) ? UNISON : MONO;
+            settings_write(ASSIGNER_UPPER_MODE, assigner_upper_mode);
         }
         if (button_pressed(BTN_SPLIT)) {
             assigner_split = !assigner_split;
             settings_write(ASSIGNER_SPLIT, assigner_split);
         }
+        if (button_pressed(BTN_LEGATO)) {
+            portamento_legato = !portamento_legato;
+            settings_write(GLIDE_LEGATO, portamento_legato);
+        }
+        // The policy buttons double as parameter buttons while a channel
+        // button is held
+        bool channel_held = false;
+        for (uint8_t chn = 0; chn < 5; chn++)
+            channel_held |= button_on(chn);
+
+        if (!channel_held) {
+            if (button_pressed(BTN_STEAL_OLDEST)) {
+                assigner_policy = STEAL_OLDEST;
+                settings_write(ASSIGNER_POLICY, STEAL_OLDEST);
+            }
+            if (button_pressed(BTN_STEAL_QUIETEST)) {
+                assigner_policy = STEAL_QUIETEST;
+                settings_write(ASSIGNER_POLICY, STEAL_QUIETEST);
+            }
+            if (button_pressed(BTN_ROUND_ROBIN)) {
+                assigner_policy = ROUND_ROBIN;
+                settings_write(ASSIGNER_POLICY, ROUND_ROBIN);
+            }
+        }
         if (button_pressed(BTN_SET_SPLIT)) {
             struct parameter parameter = parameter_get(SPLIT_POINT);
             init_getvalue(BTN_SET_SPLIT, 0xFF, &parameter);
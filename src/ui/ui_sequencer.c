@@ -25,6 +25,7 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <avr/pgmspace.h>
 #include "ui_sequencer.h"
 #include "ui.h"
@@ -34,11 +35,15 @@
 #include "settings/settings.h"
 
 #define BTN_MIDI_OUT_CHN 5
+#define BTN_LOCK 2
 #define BTN_OCTAVE 6
 #define BTN_NOTE_CLEAR 7
 
 #define BTN_RECORD 8
 #define BTN_CLEAR_SEQUENCE 9
+#define BTN_FINE_TEMPO 11
+#define BTN_SWING 12
+#define BTN_CHAIN 13
 #define BTN_END_POINT 14
 #define BTN_SCALE 15
 
@@ -56,6 +61,7 @@ static void select_note(void);
 static void play_pattern(void);
 static void record_pattern(void);
 static void enter_end_point(void);
+static void enter_lock(void);
 
 static void enter_note_init(uint8_t);
 void enter_end_point_init(void);
@@ -66,14 +72,24 @@ static void display_pattern(void);
 static int8_t channel_octave[5] = {4, 4, 4, 0, 0};
 static int8_t channel_length[5] = {3, 3, 3, 3, 3};
 
+// While a lock is edited, the white keys select the lock type or the
+// step delay
+#define BTN_LOCK_TYPE 8
+#define BTN_DELAY 15
+
 static uint8_t current_channel;
 static int8_t current_pattern;
 static uint8_t current_pos;
 static uint8_t current_note;
+static struct sequencer_note edited_note;
+static bool editing_delay;
+
+// Steps are shown 16 at a time on the step buttons
+static int8_t current_page;
 
 uint8_t sequencer_leds[6];
 
-void (*state_handlers[])(void) = {
+static void (* const state_handlers[])(void) PROGMEM = {
     [STATE_TOPLEVEL] = select_pattern,
     [STATE_SELECT_NOTE] = select_note,
     [STATE_ENTER_NOTE] = enter_note,
@@ -93,7 +109,8 @@ void ui_sequencer_setup(void)
 
 void sequencer(void)
 {
-    state_handlers[state]();
+    void (*handler)(void) = pgm_read_ptr_near(&state_handlers[state]);
+    handler();
 }
 
 
@@ -166,6 +183,28 @@ void select_pattern(void)
         mode = MODE_GETVALUE;
     }
 
+    if (button_pressed(BTN_CHAIN)) {
+        getvalue.button1 = BTN_CHAIN;
+        getvalue.button2 = 0xFF;
+        getvalue.parameter.target = &sequencer_pattern.chain;
+        getvalue.parameter.type = RANGE;
+        getvalue.parameter.min = SEQUENCER_NO_CHAIN;
+        getvalue.parameter.max = 99;
+        getvalue.previous_mode = mode;
+        mode = MODE_GETVALUE;
+    }
+
+    if (button_pressed(BTN_SWING)) {
+        getvalue.button1 = BTN_SWING;
+        getvalue.button2 = 0xFF;
+        getvalue.parameter.target = &sequencer_pattern.swing;
+        getvalue.parameter.type = RANGE;
+        getvalue.parameter.min = SEQUENCER_SWING_MIN;
+        getvalue.parameter.max = SEQUENCER_SWING_MAX;
+        getvalue.previous_mode = mode;
+        mode = MODE_GETVALUE;
+    }
+
     if (button_pressed(BTN_END_POINT)) {
         enter_end_point_init();
     }
@@ -189,6 +228,9 @@ void select_note(void)
         }
     }
 
+    ui_updown(&current_page, 0, SEQUENCER_MAX_STEPS / 16 - 1);
+
+    leds_7seg_set(3, current_page + 1);
     leds_7seg_set(4, current_channel + 1);
 
     if (button_pressed(BTN_BACK)) {
@@ -203,15 +245,17 @@ void select_note(void)
 void enter_note_init(uint8_t btn)
 {
     button_led_blink(btn);
-    current_pos = btn;
+    current_pos = current_page * 16 + btn;
     sequencer_midi_note = 0xFF;
-    current_note = sequencer_pattern.notes[current_channel][current_pos].note;
+    sequencer_note_get(current_channel, current_pos, &edited_note);
+    current_note = edited_note.note;
+    editing_delay = false;
     state = STATE_ENTER_NOTE;
 }
 
 void enter_note_exit(void)
 {
-    button_led_off(current_pos);
+    button_led_off(current_pos % 16);
     state = STATE_SELECT_NOTE;
 }
 
@@ -219,6 +263,11 @@ void enter_note(void)
 {
     uint8_t new_note = 0xFF;
 
+    if (button_on(BTN_LOCK)) {
+        enter_lock();
+        return;
+    }
+
     // Check if any of the note buttons have been pressed:
     for (uint8_t i = 0; i < 16; i++) {
         if (button_pressed(i)) {
@@ -242,7 +291,8 @@ void enter_note(void)
 
     // Other button presses:
     if (button_pressed(BTN_NOTE_CLEAR)) {
-        sequencer_pattern.notes[current_channel][current_pos].length = 0;
+        edited_note.length = 0;
+        sequencer_note_set(current_channel, current_pos, &edited_note);
         enter_note_exit();
     }
 
@@ -253,9 +303,10 @@ void enter_note(void)
 
     else if (button_pressed(BTN_OK)) {
         if (current_note != 0xFF) {
-            sequencer_pattern.notes[current_channel][current_pos].note = current_note;
-            sequencer_pattern.notes[current_channel][current_pos].length = channel_length[current_channel];
+            edited_note.note = current_note;
+            edited_note.length = channel_length[current_channel];
         }
+        sequencer_note_set(current_channel, current_pos, &edited_note);
         enter_note_exit();
     }
 
@@ -270,11 +321,59 @@ void enter_note(void)
 
 }
 
-void enter_end_point_init(void)
+static void enter_lock(void)
+/*
+  While LOCK is held, the white keys select the parameter locked by the
+  step (none, duty, volume, LFO 1-3) and UP/DOWN set its value. Locks the
+  channel doesn't have are ignored. The last white key selects the step
+  delay instead.
+*/
+{
+    if (button_pressed(BTN_DELAY))
+        editing_delay = true;
+
+    for (uint8_t lock = LOCK_NONE; lock < NUM_LOCKS; lock++) {
+        int8_t min, max;
+        if (button_pressed(BTN_LOCK_TYPE + lock)
+            && (lock == LOCK_NONE || sequencer_lock_range(current_channel, lock, &min, &max))) {
+            edited_note.lock = lock;
+            editing_delay = false;
+            if (lock != LOCK_NONE)
+                edited_note.lock_value = min;
+        }
+    }
+
+    if (editing_delay) {
+        leds_7seg_two_digit_set(3, 4, edited_note.delay);
+        ui_updown((int8_t*)&edited_note.delay, 0, SEQUENCER_MAX_DELAY);
+        return;
+    }
+
+    int8_t min, max;
+    if (edited_note.lock == LOCK_NONE || !sequencer_lock_range(current_channel, edited_note.lock, &min, &max)) {
+        leds_7seg_minus(3);
+        leds_7seg_minus(4);
+        return;
+    }
+
+    leds_7seg_two_digit_set(3, 4, edited_note.lock_value);
+    ui_updown(&edited_note.lock_value, min, max);
+}
+
+static void show_end_point(void)
 {
-    for (uint8_t i = 0; i < sequencer_pattern.end_point; i++) {
-        button_led_blink(i);
+    for (uint8_t i = 0; i < 16; i++) {
+        if (current_page * 16 + i < sequencer_pattern.end_point) {
+            button_led_blink(i);
+        }
+        else
+            button_led_off(i);
     }
+}
+
+void enter_end_point_init(void)
+{
+    show_end_point();
     state = STATE_ENTER_END_POINT;
 }
 
@@ -288,28 +387,65 @@ void enter_end_point_exit(void)
 
 void enter_end_point(void)
 {
+    if (ui_updown(&current_page, 0, SEQUENCER_MAX_STEPS / 16 - 1))
+        show_end_point();
+    leds_7seg_set(3, current_page + 1);
+
     for (uint8_t i = 0; i < 16; i++) {
         if (button_pressed(i)) {
-            sequencer_pattern.end_point = i + 1;
+            sequencer_pattern.end_point = current_page * 16 + i + 1;
             enter_end_point_exit();
         }
     }
 }
 
+static void adjust_tempo(void)
+/*
+  UP and DOWN change the tempo by one BPM, or by a tenth while FINE TEMPO
+  is held. The display shows the whole BPM, with the dot of the left
+  digit lit above 100, or the tenths while FINE TEMPO is held.
+*/
+{
+    int8_t change = 0;
+    bool fine = button_on(BTN_FINE_TEMPO);
+
+    if (ui_updown(&change, -1, 1))
+        sequencer_tempo_set(sequencer_tempo + change * (fine ? 1 : 10));
+
+    if (fine) {
+        leds_7seg_clear(3);
+        leds_7seg_set(4, sequencer_tempo % 10);
+        leds_7seg_dot_on(3);
+    }
+    else {
+        leds_7seg_two_digit_set(3, 4, sequencer_tempo / 10 % 100);
+        if (sequencer_tempo >= 1000)
+            leds_7seg_dot_on(3);
+    }
+}
+
 static void play_pattern(void)
 {
     for (uint8_t i = 0; i < 16; i++)
         button_led_off(i);
-    leds_7seg_two_digit_set(3, 4, sequencer_tempo_count);
 
-    ui_updown((int8_t*)&sequencer_tempo_count, 1, 99);
+    // Holding CHAIN selects the pattern to switch to at the end point
+    if (button_on(BTN_CHAIN)) {
+        if (ui_updown((int8_t*)&current_pattern, 0, 99)) {
+            sequencer_pattern_queue(current_pattern);
+            settings_write(SEQUENCER_SELECTED_SEQ, current_pattern);
+        }
+        leds_7seg_two_digit_set(3, 4, current_pattern);
+    }
+    else
+        adjust_tempo();
 
     if (button_pressed(BTN_PLAY)) {
         sequencer_stop();
         state = STATE_TOPLEVEL;
     }
     else
-        button_led_on(sequencer_cur_position);
+        button_led_on(sequencer_cur_position % 16);
 }
 
 static void record_pattern(void)
@@ -320,7 +456,9 @@ static void record_pattern(void)
 static void display_pattern(void)
 {
     for (uint8_t i = 0; i < 16; i++) {
-        if (sequencer_pattern.notes[current_channel][i].length != 0)
+        struct sequencer_note note;
+        sequencer_note_get(current_channel, current_page * 16 + i, &note);
+        if (note.length != 0)
             button_led_on(i);
         else
             button_led_off(i);
@@ -342,11 +480,11 @@ void save_init(int8_t* pattern)
 
 static inline uint8_t btn_to_note(uint8_t btn)
 {
-    static uint8_t notes[16] = {
+    static const uint8_t notes[16] PROGMEM = {
         1, 3, 0xFF, 6, 8, 10, 0xFF, 0xFF, 0, 2, 4, 5, 7, 9, 11, 12
     };
 
-    uint8_t note = notes[btn];
+    uint8_t note = pgm_read_byte(&notes[btn]);
     if (note != 0xFF) {
         // Add octave setting to the note:
         note += 12 * (channel_octave[current_channel] + 1);
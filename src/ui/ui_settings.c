@@ -35,11 +35,15 @@
 #include "io/leds.h"
 #include "io/input.h"
 #include "io/memory.h"
+#include "io/bus.h"
 #include "io/2a03.h"
 #include "assigner/assigner.h"
 #include "io/battery.h"
 #include "sequencer/sequencer.h"
 #include "settings/settings.h"
+#include "modulation/periods.h"
+#include "macro/macro.h"
+#include "integrity/integrity.h"
 
 #define BTN_CH0 0
 #define BTN_CH1 1
@@ -55,6 +59,7 @@
 #define BTN_SEQ_EXTCLK 10
 #define BTN_INIT_SETTINGS 11
 #define BTN_MEM_DBG 12
+#define BTN_MACRO_RATE 13
 #define BTN_SAMPLE_FORMAT 14
 #define BTN_SAMPLE_DELETE 15
 
@@ -63,6 +68,7 @@
 enum state {
     STATE_TOPLEVEL,
     STATE_MIDI_CHANNEL,
+    STATE_MACRO_RATE,
     STATE_MEM_DBG,
 };
 
@@ -74,6 +80,7 @@ static inline void mem_dbg(void);
 uint8_t settings_leds[6];
 int8_t assign_chn;
 int8_t assign_midi_chn;
+int8_t macro_rate;
 
 void settings(void)
 {
@@ -87,6 +94,12 @@ void settings(void)
         assigner_midi_channel_change(assign_midi_chn, assign_chn);
         state = STATE_TOPLEVEL;
     }
+    else if (state == STATE_MACRO_RATE) {
+        // A new macro rate has been entered
+        settings_write(MACRO_RATE, macro_rate);
+        macro_set_rate(macro_rate);
+        state = STATE_TOPLEVEL;
+    }
     else if (state == STATE_MEM_DBG) {
         mem_dbg();
     }
@@ -124,6 +137,7 @@ static inline void toplevel(void)
 
     if (button_pressed(BTN_INIT_SETTINGS)) {
         settings_init();
+        periods_setup();
     }
 
     if (button_on(BTN_CLOCKDIV)) {
@@ -181,6 +195,23 @@ static inline void toplevel(void)
         mode = MODE_GETVALUE;
     }
 
+    if (button_pressed(BTN_MACRO_RATE)) {
+        macro_rate = settings_read(MACRO_RATE);
+        if (macro_rate == 0)
+            macro_rate = MACRO_DEFAULT_RATE;
+        struct parameter parameter = {.target = &macro_rate,
+                                      .type = RANGE,
+                                      .min = 10,
+                                      .max = 99};
+        getvalue.parameter = parameter;
+        getvalue.button1 = BTN_MACRO_RATE;
+        getvalue.button2 = 0xFF;
+        getvalue.previous_mode = mode;
+        mode = MODE_GETVALUE;
+
+        state = STATE_MACRO_RATE;
+    }
+
     if (button_on(BTN_PATTERN_FORMAT))
         sequencer_pattern_init();
 
@@ -216,6 +247,59 @@ static inline void mem_dbg(void)
             addr--;
     }
 
+    // Holding BATTERY shows the time from the last program change until
+    // the new patch was heard, in 1/16 ms ticks
+    if (button_on(BTN_BATTERY)) {
+        leds_7seg_two_digit_set(3, 4, patch_load_latency > 99 ? 99 : patch_load_latency);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
+    // MIDI CHN and CLOCKDIV show the patch cache hits and misses
+    if (button_on(BTN_MIDI_CHN) || button_on(BTN_CLOCKDIV)) {
+        uint16_t count = button_on(BTN_MIDI_CHN) ? patch_cache_hits : patch_cache_misses;
+        leds_7seg_two_digit_set(3, 4, count > 99 ? 99 : count);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
+    // MACRO RATE shows the share of low and mid address latch writes
+    // avoided when setting up addresses, in percent
+    if (button_on(BTN_MACRO_RATE)) {
+        uint32_t total = (uint32_t)memory_latch_writes + memory_latch_writes_avoided;
+        uint8_t percent = total ? (uint32_t)memory_latch_writes_avoided * 100 / total : 0;
+        leds_7seg_two_digit_set(3, 4, percent > 99 ? 99 : percent);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
+    // INIT SETTINGS shows the number of bus transactions that were
+    // refused since one of the same or higher priority held the bus,
+    // which should never happen
+    if (button_on(BTN_INIT_SETTINGS)) {
+        leds_7seg_two_digit_set(3, 4, bus_conflicts > 99 ? 99 : bus_conflicts);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
+    // PATCH FORMAT shows the number of stored regions that failed their
+    // CRC check and were reset
+    if (button_on(BTN_PATCH_FORMAT)) {
+        leds_7seg_two_digit_set(3, 4, integrity_repairs > 99 ? 99 : integrity_repairs);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
+    // EXT CLK shows the share of LED scan slots in the last second that
+    // didn't use the bus, in percent
+    if (button_on(BTN_SEQ_EXTCLK)) {
+        uint8_t percent = (uint32_t)leds_skipped_slots * 100 / LEDS_REFRESH_RATE;
+        leds_7seg_two_digit_set(3, 4, percent > 99 ? 99 : percent);
+        leds_7seg_dot_on(4);
+        return;
+    }
+
     uint8_t val = memory_read(addr);
     leds_7seg_two_digit_set_hex(3, 4, val);
+    leds_7seg_dot_off(4);
 }
@@ -0,0 +1,313 @@
+/*
+  Assigner test
+
+  Replays a dense stream of MIDI notes through the note stack and the
+  voice allocator, for each stealing policy in polyphonic and
+  monophonic mode, and counts voice steals and stuck notes.
+
+  A steal is a note on that takes a channel from a note still held. A
+  stuck note is a channel still sounding a note that has been released.
+
+  Short fixed note sequences then check which channel each policy
+  steals, with the channel levels set by the test.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "apu/apu.h"
+#include "envelope/envelope.h"
+#include "modulation/modulation.h"
+#include "modulation/modmatrix.h"
+#include "portamento/portamento.h"
+#include "macro/macro.h"
+#include "sample/sample.h"
+#include "settings/settings.h"
+#include "assigner/assigner.h"
+#include "note_stack/note_stack.h"
+
+#define MIDI_CHANNEL 1
+#define NUM_EVENTS 20000
+#define MAX_HELD 12
+
+/* The parts of the synth the assigner drives */
+
+struct triangle tri;
+struct dmc dmc;
+struct envelope env[3];
+uint8_t noise_period;
+uint16_t mod_pitchbend_input[4];
+int8_t mod_unison_position[3];
+uint8_t mod_sq2_env = 1;
+int8_t mod_velocity_curve;
+int8_t mod_aftertouch_curve;
+uint8_t mod_velocity[5];
+uint8_t mod_aftertouch[5];
+uint8_t mod_timbre[5];
+const uint8_t mod_curves[2][128];
+int8_t portamento_legato;
+
+void macro_note_on(uint8_t voice) {}
+void macro_note_off(uint8_t voice) {}
+void portamento_note_on(uint8_t chn, uint8_t note, bool legato) {}
+uint8_t sample_occupied(uint8_t index) { return 0; }
+void sample_load(struct sample *sample, uint8_t index) {}
+
+static int8_t settings[SETTINGS_SIZE];
+
+int8_t settings_read(enum settings_id id)
+{
+    return settings[id];
+}
+
+void settings_write(enum settings_id id, int8_t value)
+{
+    settings[id] = value;
+}
+
+/* Test state */
+
+static bool held[128];
+static uint8_t num_held;
+static uint32_t seed = 1;
+
+static uint8_t random_byte(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+static void note_on(uint8_t note, unsigned *steals)
+{
+    uint8_t before[5];
+    for (uint8_t chn = 0; chn < 5; chn++)
+        before[chn] = assigned_notes[chn];
+
+    held[note] = true;
+    num_held++;
+    note_stack_push(MIDI_CHANNEL, note);
+
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (before[chn] && before[chn] != note && held[before[chn]] && assigned_notes[chn] != before[chn])
+            (*steals)++;
+    }
+}
+
+static void note_off(uint8_t note)
+{
+    held[note] = false;
+    num_held--;
+    note_stack_pop(MIDI_CHANNEL, note);
+}
+
+static unsigned count_stuck(void)
+{
+    unsigned stuck = 0;
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (assigned_notes[chn] && !held[assigned_notes[chn]])
+            stuck++;
+    }
+    return stuck;
+}
+
+static void release_all(void)
+{
+    for (uint8_t n = 0; n < 128; n++) {
+        if (held[n])
+            note_off(n);
+    }
+}
+
+static void setup(enum assigner_mode mode, enum assigner_policy policy)
+{
+    for (uint8_t i = 0; i < 5; i++) {
+        settings_write(MIDI_CHN + i, MIDI_CHANNEL);
+        assigner_enabled[i] = 1;
+    }
+    settings_write(ASSIGNER_LOWER_MODE, mode);
+    settings_write(ASSIGNER_UPPER_MODE, mode);
+    settings_write(ASSIGNER_POLICY, policy);
+    assigner_setup();
+    note_stack_clear();
+}
+
+static bool run(enum assigner_mode mode, enum assigner_policy policy, const char *name)
+{
+    setup(mode, policy);
+
+    unsigned steals = 0;
+    unsigned stuck = 0;
+    seed = 1;
+
+    for (unsigned i = 0; i < NUM_EVENTS; i++) {
+        // Notes 36..99, from the bottom of the DMC sample range
+        uint8_t note = 36 + random_byte() % 64;
+
+        if (held[note] || (num_held == MAX_HELD))
+            note = 0;
+
+        if (note && (num_held < 3 || random_byte() & 1)) {
+            note_on(note, &steals);
+        }
+        else {
+            // Release a random held note
+            uint8_t skip = random_byte() % (num_held ? num_held : 1);
+            for (uint8_t n = 0; n < 128 && num_held; n++) {
+                if (held[n] && skip-- == 0) {
+                    note_off(n);
+                    break;
+                }
+            }
+        }
+
+        stuck += count_stuck();
+    }
+
+    release_all();
+    stuck += count_stuck();
+
+    // Every note takes all channels in monophonic mode, so only stuck
+    // notes are of interest there
+    if (mode == POLY)
+        printf("poly %-9s steals %5u  stuck %u\n", name, steals, stuck);
+    else
+        printf("mono %-9s stuck %u\n", name, stuck);
+    return stuck == 0;
+}
+
+/* Steal order */
+
+static const char *const channel_names[5] = {"SQ1", "SQ2", "TRI", "NOISE", "DMC"};
+
+static uint8_t channel_of(uint8_t note)
+{
+    for (uint8_t chn = 0; chn < 5; chn++) {
+        if (assigned_notes[chn] == note)
+            return chn;
+    }
+    return 0xFF;
+}
+
+static bool expect(const char *name, uint8_t note, uint8_t chn)
+/* Plays a note and checks that it is given the channel */
+{
+    unsigned steals = 0;
+    note_on(note, &steals);
+
+    uint8_t got = channel_of(note);
+    if (got == chn)
+        return true;
+
+    printf("FAIL: %s: note %u went to %s instead of %s\n", name, note,
+           (got == 0xFF) ? "no channel" : channel_names[got], channel_names[chn]);
+    return false;
+}
+
+static void steal_setup(enum assigner_policy policy)
+/*
+  Fills the four pitched and noise channels with notes 60 to 63. The DMC
+  is moved to another MIDI channel, since it never sounds in this test
+  and would always be the quietest.
+*/
+{
+    setup(POLY, policy);
+    assigner_midi_channel_change(MIDI_CHANNEL + 1, CHN_DMC);
+
+    for (uint8_t i = 0; i < 3; i++)
+        env[i].value = 0;
+
+    unsigned steals = 0;
+    for (uint8_t note = 60; note < 64; note++)
+        note_on(note, &steals);
+}
+
+static bool steal_oldest(void)
+{
+    bool ok = true;
+    steal_setup(STEAL_OLDEST);
+
+    // Levels don't matter, only the order the notes were played in
+    env[0].value = 15;
+    env[2].value = 1;
+
+    uint8_t first = channel_of(60);
+    uint8_t second = channel_of(61);
+    uint8_t third = channel_of(62);
+    ok &= expect("oldest", 64, first);
+    ok &= expect("oldest", 65, second);
+    ok &= expect("oldest", 66, third);
+
+    // Note 63 is now the oldest, followed by note 64
+    ok &= expect("oldest", 67, channel_of(63));
+    ok &= expect("oldest", 68, first);
+
+    release_all();
+    printf("steal oldest   %s\n", ok ? "as expected" : "FAIL");
+    return ok;
+}
+
+static bool steal_quietest(void)
+{
+    bool ok = true;
+    steal_setup(STEAL_QUIETEST);
+
+    // SQ1 at 9, SQ2 at 4, NOISE at 12 and TRI always at full level
+    env[0].value = 9;
+    env[1].value = 4;
+    env[2].value = 12;
+
+    ok &= expect("quietest", 64, CHN_SQ2);
+
+    // The quietest channel is taken again even though its note is newest
+    ok &= expect("quietest", 65, CHN_SQ2);
+
+    // Between equally quiet channels, the one with the older note goes
+    env[0].value = 4;
+    ok &= expect("quietest", 66, CHN_SQ1);
+
+    release_all();
+    printf("steal quietest %s\n", ok ? "as expected" : "FAIL");
+    return ok;
+}
+
+static bool steal_round_robin(void)
+/* Channels are taken in turn, whether they are free or held */
+{
+    bool ok = true;
+    steal_setup(ROUND_ROBIN);
+
+    env[1].value = 15;
+
+    // A free channel is still taken first. This puts the turns out of
+    // step with the order of the notes, so the next steal isn't of the
+    // oldest note.
+    uint8_t chn = channel_of(62);
+    note_off(62);
+    ok &= expect("round", 64, chn);
+
+    for (uint8_t note = 65; note < 73; note++) {
+        if (++chn == CHN_DMC)
+            chn = CHN_SQ1;
+        ok &= expect("round", note, chn);
+    }
+
+    release_all();
+    printf("steal round    %s\n", ok ? "as expected" : "FAIL");
+    return ok;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    ok &= run(POLY, STEAL_OLDEST, "oldest");
+    ok &= run(POLY, STEAL_QUIETEST, "quietest");
+    ok &= run(POLY, ROUND_ROBIN, "round");
+    ok &= run(MONO, STEAL_OLDEST, "oldest");
+
+    ok &= steal_oldest();
+    ok &= steal_quietest();
+    ok &= steal_round_robin();
+
+    return ok ? 0 : 1;
+}
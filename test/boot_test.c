@@ -0,0 +1,226 @@
+/*
+  Boot test
+
+  Boots the whole firmware on the hardware model in sim.c and measures
+  the time from power-on to the first note, in ticks of the 16 kHz
+  timer. A note on is received right at power-on, and the note is taken
+  to start when a channel is first given a volume.
+
+  The model's clock counts register accesses, at about three cycles
+  each with the code around them. Startup is mostly SRAM traffic, which
+  is counted, while computation between the accesses is not, so the
+  times are on the low side.
+
+  Each boot runs in a child process, so that it starts from a clean
+  slate, while the SRAM is shared between them like the battery backed
+  SRAM is between power cycles:
+
+  - with the SRAM full of garbage, which formats it in the background.
+    The power is switched off shortly after the note.
+  - with the format left half done, which carries it on. This boot runs
+    until the format is done.
+  - with everything formatted
+
+  Carrying on the format must not hold up the boot, so the second boot
+  has to be about as fast as the third.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "io/2a03.h"
+#include "io/memory.h"
+#include "apu/apu.h"
+#include "integrity/integrity.h"
+#include "task/task.h"
+#include "sim.h"
+
+// The longest acceptable time from power-on to the first note: 40 ms
+#define MAX_BOOT_TICKS 641
+
+// A boot carrying on a format may be this much slower than one after it
+// is done: 1 ms
+#define FORMAT_SLACK_TICKS 16
+
+// Time left for the format before the power is switched off
+#define POWER_OFF_TICKS 800
+
+// Give up on a boot after four seconds
+#define TIMEOUT_TICKS 64000
+
+// Firmware code running this long without touching a register is
+// waiting for the next tick
+#define IDLE_NS 20000
+#define IDLE_CHECK_US 20
+
+// The volume registers of the channels
+#define SQ1_VOL 0x00
+#define SQ2_VOL 0x04
+#define TRI_LINEAR 0x08
+#define NOISE_VOL 0x0C
+
+enum power_off {
+    AFTER_NOTE,
+    AFTER_FORMAT
+};
+
+struct boot {
+    uint32_t note;
+    bool formatted;
+    uint32_t formatted_at;
+    bool powered_off;
+};
+
+int nesizer_main(void);
+
+static uint8_t *sram;
+static struct boot *boot;
+static uint8_t power_off;
+
+static void power_check(void)
+{
+    uint32_t now = sim_ticks();
+    bool formatted = !integrity_formatting;
+
+    if (formatted && !boot->formatted) {
+        boot->formatted = true;
+        boot->formatted_at = now;
+    }
+
+    if (power_off == AFTER_NOTE && boot->note && now >= boot->note + POWER_OFF_TICKS)
+        _exit(0);
+    if (power_off == AFTER_FORMAT && boot->note && formatted)
+        _exit(0);
+    if (now >= TIMEOUT_TICKS)
+        _exit(0);
+}
+
+/* The 2A03, which only has its writes watched */
+
+uint8_t io_reg_buffer[0x18];
+uint8_t io_clockdiv = 12;
+
+void io_setup(void) {}
+void io_register_write(uint8_t reg, uint8_t value) {}
+void io_reset_pc(void) {}
+
+void io_write_changed(uint8_t reg)
+{
+    bool sounding = false;
+
+    if (reg == SQ1_VOL || reg == SQ2_VOL || reg == NOISE_VOL)
+        sounding = io_reg_buffer[reg] & 0x0F;
+    else if (reg == TRI_LINEAR)
+        sounding = io_reg_buffer[reg] & 0x7F;
+
+    if (sounding && !boot->note)
+        boot->note = sim_ticks();
+
+    power_check();
+}
+
+/* The test */
+
+static void idle_check(int signal)
+/*
+  The firmware waits for the next tick in a loop that doesn't touch any
+  registers, so the model's clock would stop. It is run on to the next
+  tick when the firmware's own CPU time shows it has been spinning.
+*/
+{
+    static uint32_t clock;
+    static struct timespec since;
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    if (sim_clock != clock) {
+        clock = sim_clock;
+        since = now;
+        return;
+    }
+
+    if ((now.tv_sec - since.tv_sec) * 1000000000L + now.tv_nsec - since.tv_nsec >= IDLE_NS)
+        sim_idle();
+}
+
+static void run(uint8_t off)
+{
+    *boot = (struct boot) {0};
+
+    if (fork() == 0) {
+        sim_sram = sram;
+        power_off = off;
+
+        struct sigaction action = {.sa_handler = idle_check, .sa_flags = SA_RESTART};
+        sigaction(SIGALRM, &action, NULL);
+        struct itimerval interval = {
+            .it_interval = {.tv_usec = IDLE_CHECK_US},
+            .it_value = {.tv_usec = IDLE_CHECK_US}
+        };
+        setitimer(ITIMER_REAL, &interval, NULL);
+
+        // A note on for MIDI channel 1, the default for all channels
+        sim_midi_receive(0x90);
+        sim_midi_receive(60);
+        sim_midi_receive(100);
+
+        nesizer_main();
+        _exit(1);
+    }
+
+    int status;
+    wait(&status);
+    boot->powered_off = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool report(const char *name, bool format_done)
+{
+    bool ok = boot->powered_off && boot->note && boot->note <= MAX_BOOT_TICKS
+        && boot->formatted == format_done;
+
+    printf("%-12s first note %5u ticks  %6.1f ms", name, boot->note,
+           boot->note * 1000.0 / TASK_TICK_RATE);
+    if (boot->formatted)
+        printf("  formatted by %6.1f ms", boot->formatted_at * 1000.0 / TASK_TICK_RATE);
+    printf("%s\n", ok ? "" : "  FAIL");
+
+    return ok;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    sram = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    boot = mmap(NULL, sizeof(struct boot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < MEMORY_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        sram[i] = seed >> 16;
+    }
+
+    run(AFTER_NOTE);
+    ok &= report("garbage", false);
+
+    run(AFTER_FORMAT);
+    ok &= report("half format", true);
+    uint32_t carried_on = boot->note;
+
+    run(AFTER_NOTE);
+    ok &= report("formatted", true);
+
+    if (carried_on > boot->note + FORMAT_SLACK_TICKS) {
+        printf("FAIL: carrying on the format held up the boot\n");
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
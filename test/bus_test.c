@@ -0,0 +1,182 @@
+/*
+  Bus interleaving test
+
+  Runs SRAM bursts against a model of the bus hardware, with the timer
+  interrupt firing every few register accesses. bus_yield then lets
+  task_yield run apu_dmc_update_handler between the bytes of the
+  bursts, and the DMC reads the next byte of a sample through its own
+  memory context.
+
+  The model in sim.c goes through the register accesses in order, so a
+  latch left holding another context's address shows up as a wrong byte
+  in the burst or in the sample.
+
+  Finally, transactions are started inside a bulk transfer, where only
+  those of higher priority may start.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "io/bus.h"
+#include "io/memory.h"
+#include "io/2a03.h"
+#include "apu/apu.h"
+#include "task/task.h"
+#include "sample/sample.h"
+#include "sim.h"
+
+// Register accesses between two timer interrupts. A burst byte takes
+// about 70, so the DMC fetches a byte every one or two burst bytes, far
+// more often than on the hardware.
+#define ACCESSES_PER_TICK 100
+
+#define SAMPLE_SIZE 2500
+#define BURST_SIZE 8192
+#define NUM_BURSTS 4
+
+#define READ_ADDRESS MEMORY_PATCH_START
+#define WRITE_ADDRESS MEMORY_PATTERN_START
+
+#define DMC_RAW 0x11
+
+static uint8_t sram[MEMORY_SIZE];
+
+/* The rest of the firmware */
+
+uint8_t io_reg_buffer[0x18];
+uint8_t io_clockdiv = 12;
+
+static uint8_t played[0x10000];
+static uint32_t num_played;
+
+void io_register_write(uint8_t reg, uint8_t value)
+{
+    if (reg == DMC_RAW && num_played < sizeof(played))
+        played[num_played++] = value;
+}
+
+void io_write_changed(uint8_t reg) {}
+void io_reset_pc(void) {}
+
+void integrity_require(uint8_t region) {}
+void integrity_touch(uint8_t region) {}
+
+void lfo_update_handler(void) {}
+void midi_io_handler(void) {}
+void sequencer_timing_handler(void) {}
+void envelope_update_handler(void) {}
+void portamento_handler(void) {}
+void macro_handler(void) {}
+void midi_handler(void) {}
+void patch_commit_handler(void) {}
+void morph_handler(void) {}
+void mod_calculate(void) {}
+void mod_apply(void) {}
+void sequencer_handler(void) {}
+void leds_refresh(void) {}
+void input_refresh(void) {}
+void ui_handler(void) {}
+void ui_leds_handler(void) {}
+void integrity_handler(void) {}
+
+/* The test */
+
+static inline uint8_t sample_value(uint32_t i)
+{
+    return (i * 7 + (i >> 8)) & 0xFF;
+}
+
+static inline uint8_t burst_value(uint32_t address)
+{
+    return (address * 13 + (address >> 9)) & 0xFF;
+}
+
+static bool check(bool condition, const char *what)
+{
+    if (!condition)
+        printf("FAIL: %s\n", what);
+    return condition;
+}
+
+int main(void)
+{
+    bool ok = true;
+    static uint8_t buffer[BURST_SIZE];
+
+    sim_sram = sram;
+    sim_accesses_per_tick = ACCESSES_PER_TICK;
+
+    bus_setup();
+    memory_setup();
+    task_setup();
+
+    // The sample spans three blocks, so the DMC also looks up the block
+    // table in the middle of the bursts
+    struct sample sample = {.type = SAMPLE_TYPE_RAW, .size = SAMPLE_SIZE};
+    sample_clear_all();
+    sample_new(&sample, 0);
+    for (uint32_t i = 0; i < SAMPLE_SIZE; i++)
+        sample_write_serial(&sample, sample_value(i));
+
+    sample_load(&dmc.sample, 0);
+    dmc.sample_loop = 1;
+    dmc.sample_enabled = 1;
+    dmc.rate = DMC_RATE_NORMAL;
+
+    for (uint32_t i = 0; i < NUM_BURSTS * BURST_SIZE; i++)
+        sram[READ_ADDRESS + i] = burst_value(READ_ADDRESS + i);
+
+    uint32_t read_errors = 0;
+    uint32_t write_errors = 0;
+
+    for (uint8_t n = 0; n < NUM_BURSTS; n++) {
+        uint32_t address = READ_ADDRESS + (uint32_t)n * BURST_SIZE;
+        memory_read_burst(address, buffer, BURST_SIZE);
+        for (uint16_t i = 0; i < BURST_SIZE; i++) {
+            if (buffer[i] != burst_value(address + i))
+                read_errors++;
+        }
+
+        address = WRITE_ADDRESS + (uint32_t)n * BURST_SIZE;
+        memory_write_burst(address, buffer, BURST_SIZE);
+        for (uint16_t i = 0; i < BURST_SIZE; i++) {
+            if (sram[address + i] != buffer[i])
+                write_errors++;
+        }
+    }
+
+    uint32_t dmc_errors = 0;
+    for (uint32_t i = 0; i < num_played; i++) {
+        if (played[i] != (sample_value(i % SAMPLE_SIZE) & 0x7F))
+            dmc_errors++;
+    }
+
+    uint16_t conflicts = bus_conflicts;
+
+    uint8_t bulk = bus_begin(BUS_SRAM_BULK);
+    bool panel_refused = bus_begin(BUS_PANEL) == BUS_REFUSED;
+    bool bulk_refused = bus_begin(BUS_SRAM_BULK) == BUS_REFUSED;
+    uint8_t dmc_previous = bus_begin(BUS_DMC);
+    bool dmc_started = dmc_previous == BUS_SRAM_BULK;
+    if (dmc_started)
+        bus_end(dmc_previous);
+    bus_end(bulk);
+
+    printf("burst bytes    %u\n", 2 * NUM_BURSTS * BURST_SIZE);
+    printf("dmc fetches    %u\n", num_played);
+    printf("errors         read %u  write %u  dmc %u\n", read_errors, write_errors, dmc_errors);
+    printf("bus conflicts  %u\n", conflicts);
+
+    ok &= check(num_played > SAMPLE_SIZE, "the DMC didn't run through the sample during the bursts");
+    ok &= check(read_errors == 0, "burst read corrupted");
+    ok &= check(write_errors == 0, "burst write corrupted");
+    ok &= check(dmc_errors == 0, "sample read corrupted");
+    ok &= check(conflicts == 0, "bus transactions overlapped");
+    ok &= check(panel_refused && bulk_refused, "transaction started inside one of the same or higher priority");
+    ok &= check(dmc_started, "transaction of higher priority refused");
+    ok &= check(bus_owner == BUS_IDLE, "bus not given back");
+
+    return ok ? 0 : 1;
+}
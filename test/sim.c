@@ -0,0 +1,158 @@
+/*
+  Hardware model
+
+  The I/O registers are read and written through sim_register(), which
+  brings the model up to date with the last access first. It has the
+  address decoder, the three address latches and the two SRAM chips on
+  the bus, the switch buffer with no buttons pressed, the MIDI receiver
+  and the ADC. The 2A03 isn't modelled, so the tests provide the
+  functions in io/2a03.h themselves.
+
+  The interrupts are given between register accesses: the timer every
+  sim_accesses_per_tick accesses once it is enabled, and the MIDI
+  receive interrupt when there is a received byte.
+*/
+
+#include <stdbool.h>
+#include <avr/io.h>
+#include "io/bus.h"
+#include "io/memory.h"
+#include "sim.h"
+
+void TIMER0_COMPA_vect(void);
+
+// Only linked by the tests that include io/midi.c
+void USART_RX_vect(void) __attribute__((weak));
+
+#define RX_SIZE 64
+
+uint16_t sim_accesses_per_tick = 400;
+uint32_t sim_clock;
+uint8_t *sim_sram;
+uint8_t sim_adc = 0xFF;
+
+static uint8_t registers[SIM_NUM_REGISTERS];
+static uint8_t latches[8];
+static bool write_enabled;
+static bool in_interrupt;
+
+static uint8_t rx[RX_SIZE];
+static uint8_t rx_read;
+static uint8_t rx_count;
+
+static uint8_t data_out(void)
+{
+    return (registers[SIM_PORTC] & DATA_PORTC_m) | (registers[SIM_PORTD] & DATA_PORTD_m);
+}
+
+static bool data_input(void)
+{
+    return !(registers[SIM_DDRC] & DATA_PORTC_m) && !(registers[SIM_DDRD] & DATA_PORTD_m);
+}
+
+static bool sram_selected(uint32_t *address)
+/* Gives the address on the SRAM pins, if one of the chips is selected */
+{
+    uint8_t high = latches[MEMORY_HIGH_ADDRESS];
+    bool first = !(high & 0b01000);
+    bool second = !(high & 0b10000);
+
+    if (first == second)
+        return false;
+
+    *address = (second ? 0x80000 : 0) | (uint32_t)(high & 0x07) << 16
+        | (uint16_t)latches[MEMORY_MID_ADDRESS] << 8 | latches[MEMORY_LOW_ADDRESS];
+    return true;
+}
+
+static void update(void)
+/* Brings the hardware up to date with the last register access */
+{
+    bool enabled = registers[SIM_PORTB] & BUS_EN_m;
+    uint8_t selected = registers[SIM_PORTB] & ADDR_m;
+
+    // The selected latch follows the bus while it is selected
+    if (enabled)
+        latches[selected] = data_out();
+
+    // The SRAM takes the data on the rising edge of WE
+    bool we = !(registers[SIM_PORTC] & WE);
+    uint32_t address;
+    if (write_enabled && !we && sram_selected(&address))
+        sim_sram[address] = data_out();
+    write_enabled = we;
+
+    // The SRAM or the switch buffer drives the data pins set as inputs
+    // while selected. Otherwise, they are held up by the pull-ups.
+    uint8_t pins = data_out();
+    if (data_input()) {
+        if (enabled && selected == SWITCHCOL_ADDRESS)
+            pins = 0;
+        else if (!enabled && !we && sram_selected(&address))
+            pins = sim_sram[address];
+    }
+    registers[SIM_PINC] = pins & DATA_PORTC_m;
+    registers[SIM_PIND] = pins & DATA_PORTD_m;
+
+    // A conversion is done by the next access
+    if (registers[SIM_ADCSRA] & (1 << ADSC)) {
+        registers[SIM_ADCSRA] &= ~(1 << ADSC);
+        registers[SIM_ADCH] = sim_adc;
+    }
+
+    // Sending takes no time
+    registers[SIM_UCSR0A] = (1 << UDRE0) | (rx_count ? 1 << RXC0 : 0);
+}
+
+static void interrupts(bool tick)
+{
+    if (in_interrupt)
+        return;
+    in_interrupt = true;
+
+    if (tick && (registers[SIM_TIMSK0] & (1 << OCIE0A)))
+        TIMER0_COMPA_vect();
+
+    if (rx_count && (registers[SIM_UCSR0B] & (1 << RXCIE0)) && USART_RX_vect)
+        USART_RX_vect();
+
+    in_interrupt = false;
+}
+
+volatile uint8_t *sim_register(uint8_t reg)
+{
+    update();
+
+    // UDR0 is written to send as well, so a byte is only taken from the
+    // receiver by the interrupt
+    if (reg == SIM_UDR0 && in_interrupt && rx_count) {
+        registers[SIM_UDR0] = rx[rx_read];
+        rx_read = (rx_read + 1) % RX_SIZE;
+        rx_count--;
+    }
+
+    interrupts(++sim_clock % sim_accesses_per_tick == 0);
+
+    return &registers[reg];
+}
+
+uint32_t sim_ticks(void)
+{
+    return sim_clock / sim_accesses_per_tick;
+}
+
+void sim_idle(void)
+/* Lets the clock run to the next tick, as while the firmware waits for it */
+{
+    sim_clock += sim_accesses_per_tick - sim_clock % sim_accesses_per_tick;
+    interrupts(true);
+}
+
+void sim_midi_receive(uint8_t byte)
+{
+    if (rx_count == RX_SIZE)
+        return;
+
+    rx[(rx_read + rx_count) % RX_SIZE] = byte;
+    rx_count++;
+}
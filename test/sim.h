@@ -0,0 +1,26 @@
+/*
+  Hardware model
+
+  Stands in for the hardware around the microcontroller in the host
+  tests, through the I/O registers in stub/avr/io.h.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Register accesses per 16 kHz timer tick. This is the model's clock.
+extern uint16_t sim_accesses_per_tick;
+
+// Register accesses since the start
+extern uint32_t sim_clock;
+
+// The contents of the two SRAM chips, MEMORY_SIZE bytes, given by the test
+extern uint8_t *sim_sram;
+
+// Read from the ADC, which measures the battery voltage
+extern uint8_t sim_adc;
+
+uint32_t sim_ticks(void);
+void sim_idle(void);
+void sim_midi_receive(uint8_t byte);
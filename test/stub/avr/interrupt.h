@@ -0,0 +1,10 @@
+/* Host stand-in for avr/interrupt.h, for the tests */
+
+#pragma once
+
+// An interrupt handler is a plain function, which the test calls to
+// simulate the interrupt
+#define ISR(vector) void vector(void); void vector(void)
+
+#define sei()
+#define cli()
@@ -0,0 +1,63 @@
+/* Host stand-in for avr/io.h, for the tests */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+  The I/O registers are provided by sim_register() in sim.c, which
+  models the hardware connected to the ports. Only tests building code
+  that uses the registers have to link it.
+*/
+enum sim_register {
+    SIM_PORTB, SIM_PORTC, SIM_PORTD,
+    SIM_DDRB, SIM_DDRC, SIM_DDRD,
+    SIM_PINB, SIM_PINC, SIM_PIND,
+    SIM_TCCR0A, SIM_TCCR0B, SIM_OCR0A, SIM_TIMSK0,
+    SIM_UBRR0H, SIM_UBRR0L, SIM_UCSR0A, SIM_UCSR0B, SIM_UCSR0C, SIM_UDR0,
+    SIM_DIDR0, SIM_ADMUX, SIM_ADCSRA, SIM_ADCH,
+    SIM_NUM_REGISTERS
+};
+
+volatile uint8_t *sim_register(uint8_t reg);
+
+#define PORTB (*sim_register(SIM_PORTB))
+#define PORTC (*sim_register(SIM_PORTC))
+#define PORTD (*sim_register(SIM_PORTD))
+#define DDRB (*sim_register(SIM_DDRB))
+#define DDRC (*sim_register(SIM_DDRC))
+#define DDRD (*sim_register(SIM_DDRD))
+#define PINB (*sim_register(SIM_PINB))
+#define PINC (*sim_register(SIM_PINC))
+#define PIND (*sim_register(SIM_PIND))
+#define TCCR0A (*sim_register(SIM_TCCR0A))
+#define TCCR0B (*sim_register(SIM_TCCR0B))
+#define OCR0A (*sim_register(SIM_OCR0A))
+#define TIMSK0 (*sim_register(SIM_TIMSK0))
+#define UBRR0H (*sim_register(SIM_UBRR0H))
+#define UBRR0L (*sim_register(SIM_UBRR0L))
+#define UCSR0A (*sim_register(SIM_UCSR0A))
+#define UCSR0B (*sim_register(SIM_UCSR0B))
+#define UCSR0C (*sim_register(SIM_UCSR0C))
+#define UDR0 (*sim_register(SIM_UDR0))
+#define DIDR0 (*sim_register(SIM_DIDR0))
+#define ADMUX (*sim_register(SIM_ADMUX))
+#define ADCSRA (*sim_register(SIM_ADCSRA))
+#define ADCH (*sim_register(SIM_ADCH))
+
+#define WGM00 0
+#define CS00 0
+#define OCIE0A 1
+#define FOC0A 7
+#define TXEN0 3
+#define RXEN0 4
+#define RXCIE0 7
+#define UCSZ00 1
+#define RXC0 7
+#define UDRE0 5
+#define ADC5D 5
+#define REFS0 6
+#define ADLAR 5
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
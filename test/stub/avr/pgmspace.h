@@ -0,0 +1,15 @@
+/* Host stand-in for avr/pgmspace.h, for the tests */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_word_near(addr) pgm_read_word(addr)
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define pgm_read_ptr_near(addr) pgm_read_ptr(addr)
+#define memcpy_P memcpy
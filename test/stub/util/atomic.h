@@ -0,0 +1,8 @@
+/* Host stand-in for util/atomic.h, for the tests */
+
+#pragma once
+
+// Interrupts are only simulated between register accesses, so a block
+// without any is atomic as it is
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (int atomic_once = 1; atomic_once; atomic_once = 0)
@@ -0,0 +1,7 @@
+/* Host stand-in for util/delay.h, for the tests */
+
+#pragma once
+
+// The model's clock only runs on register accesses, so delays take no time
+#define _delay_us(us)
+#define _delay_ms(ms)
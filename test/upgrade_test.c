@@ -0,0 +1,162 @@
+/*
+  Upgrade test
+
+  Fills the SRAM of the hardware model in sim.c with what the first
+  firmware stored, on top of garbage, and runs the firmware's startup
+  check. The settings, patches and patterns saved by the first firmware
+  must then read back with the same values, and the settings added since
+  must have their defaults.
+
+  The first firmware kept the RAM magic in the first 32 bytes, its 11
+  settings at 0x80, and the patches at 0x100 as a plain array of the values of the first 64
+  parameters each. The patterns followed, with a note and a length for
+  each of 16 steps of each channel, and then the scale and end point.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "io/bus.h"
+#include "io/memory.h"
+#include "patch/patch.h"
+#include "parameter/parameter.h"
+#include "sequencer/sequencer.h"
+#include "settings/settings.h"
+#include "modulation/periods.h"
+#include "sim.h"
+
+#define MAGIC 0xdeadbeef
+
+#define OLD_SETTINGS_START 0x80
+#define OLD_NUM_SETTINGS 11
+#define OLD_PATCH_START 0x100
+#define OLD_PATCH_SIZE 64
+#define OLD_PATTERN_START 6656
+#define OLD_PATTERN_SIZE 162
+#define OLD_NUM_PATTERNS 100
+#define OLD_STEPS 16
+
+static uint8_t sram[MEMORY_SIZE];
+
+void startup_check(void);
+
+/* The 2A03, which isn't used */
+
+uint8_t io_reg_buffer[0x18];
+uint8_t io_clockdiv = 12;
+
+void io_setup(void) {}
+void io_register_write(uint8_t reg, uint8_t value) {}
+void io_write_changed(uint8_t reg) {}
+void io_reset_pc(void) {}
+
+/* The test */
+
+static inline int8_t old_value(uint8_t patch, uint8_t id)
+{
+    return (patch * 7 + id * 3) % 50;
+}
+
+static inline uint8_t old_note(uint8_t pattern, uint8_t chn, uint8_t pos)
+{
+    return (pattern + chn * 17 + pos * 5) % 128;
+}
+
+static inline uint8_t old_length(uint8_t pattern, uint8_t chn, uint8_t pos)
+{
+    return (pattern + chn + pos) % 7;
+}
+
+static bool check(bool condition, const char *what)
+{
+    if (!condition)
+        printf("FAIL: %s\n", what);
+    return condition;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < MEMORY_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        sram[i] = seed >> 16;
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        for (uint8_t b = 0; b < 4; b++)
+            sram[4 * i + b] = (uint32_t)MAGIC >> (8 * b);
+    }
+
+    for (uint8_t id = 0; id < OLD_NUM_SETTINGS; id++)
+        sram[OLD_SETTINGS_START + id] = id + 1;
+
+    for (uint8_t num = 0; num <= PATCH_MAX; num++) {
+        for (uint8_t id = 0; id < OLD_PATCH_SIZE; id++)
+            sram[OLD_PATCH_START + OLD_PATCH_SIZE * num + id] = old_value(num, id);
+    }
+
+    for (uint8_t pat = 0; pat < OLD_NUM_PATTERNS; pat++) {
+        uint32_t address = OLD_PATTERN_START + (uint32_t)OLD_PATTERN_SIZE * pat;
+        for (uint8_t chn = 0; chn < 5; chn++) {
+            for (uint8_t pos = 0; pos < OLD_STEPS; pos++) {
+                sram[address++] = old_note(pat, chn, pos);
+                sram[address++] = old_length(pat, chn, pos);
+            }
+        }
+        sram[address++] = pat % 12;
+        sram[address] = 1 + pat % OLD_STEPS;
+    }
+
+    sim_sram = sram;
+    bus_setup();
+    memory_setup();
+    startup_check();
+
+    uint16_t settings_errors = 0;
+    for (uint8_t id = 0; id < SETTINGS_SIZE; id++) {
+        if (settings_read(id) != ((id < OLD_NUM_SETTINGS) ? id + 1 : 0))
+            settings_errors++;
+    }
+
+    uint16_t patch_errors = 0;
+    for (uint8_t num = 0; num <= PATCH_MAX; num++) {
+        int8_t values[NUM_PARAMETERS];
+        patch_read(num, values);
+
+        for (uint8_t id = 0; id < NUM_PARAMETERS; id++) {
+            int8_t expected = (id < OLD_PATCH_SIZE) ? old_value(num, id) : parameter_get(id).initial_value;
+            if (values[id] != expected)
+                patch_errors++;
+        }
+    }
+
+    uint16_t pattern_errors = 0;
+    for (uint8_t pat = 0; pat < OLD_NUM_PATTERNS; pat++) {
+        sequencer_pattern_load(pat);
+        if (sequencer_pattern.scale != pat % 12 || sequencer_pattern.end_point != 1 + pat % OLD_STEPS
+            || sequencer_pattern.chain != SEQUENCER_NO_CHAIN)
+            pattern_errors++;
+
+        for (uint8_t chn = 0; chn < 5; chn++) {
+            for (uint8_t pos = 0; pos < SEQUENCER_MAX_STEPS; pos++) {
+                struct sequencer_note note;
+                sequencer_note_get(chn, pos, &note);
+                uint8_t length = (pos < OLD_STEPS) ? old_length(pat, chn, pos) : 0;
+                if (note.length != length || (length && note.note != old_note(pat, chn, pos)))
+                    pattern_errors++;
+            }
+        }
+    }
+
+    printf("errors         settings %u  patches %u  patterns %u\n", settings_errors, patch_errors, pattern_errors);
+    printf("A4             %u.%u Hz\n", periods_a4() / 10, periods_a4() % 10);
+
+    ok &= check(settings_errors == 0, "settings not kept or not initialized");
+    ok &= check(periods_a4() == 4400, "tuning not at 440 Hz");
+    ok &= check(patch_errors == 0, "patches of the first firmware lost");
+    ok &= check(pattern_errors == 0, "patterns of the first firmware lost");
+
+    return ok ? 0 : 1;
+}